@@ -0,0 +1,44 @@
+// NullStream.cpp: Sound output backend without a device, the host pulls the samples with FillBuffer itself.
+// Used by the benchmark so that no audio thread competes with the measured code, and by the driver test.
+
+#include "Tests/NullStream.hpp"
+#include "src/audio/stream.hpp"
+
+extern "C" uint32_t SampleRate;
+
+static NULL_STREAM_STATE State{};
+
+NULL_STREAM_STATE GetNullStreamState(){
+	return State;
+}
+
+uint8_t SoundLogging([[maybe_unused]] bool Mode){
+	return 0x00;
+}
+
+uint8_t StartStream([[maybe_unused]] uint8_t DeviceID, [[maybe_unused]] const STREAM_OPTIONS &Options){
+	State = {};
+	if(!SampleRate){
+		SampleRate = 44100;    // there's no native rate to fall back to
+	}
+	return 0x00;
+}
+
+bool GetStreamInfo([[maybe_unused]] STREAM_INFO &Info){
+	return false;
+}
+
+uint8_t StopStream([[maybe_unused]] bool SkipWOClose){
+	return 0x00;
+}
+
+// No device to stop or restart, a host pulling the samples itself calls PrerenderBuffer on resume if it likes
+void PauseStream(bool PauseOn, uint32_t SuspendMs){
+	if(PauseOn){
+		State.Pauses++;
+		State.SuspendMs = SuspendMs;
+	}else if(State.Paused){
+		State.Resumes++;
+	}
+	State.Paused = PauseOn;
+}
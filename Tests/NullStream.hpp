@@ -0,0 +1,13 @@
+// NullStream.hpp: what the driver last told the device-less backend, for checking pause and resume
+#pragma once
+
+#include <cstdint>
+
+struct NULL_STREAM_STATE {
+	bool Paused;
+	uint32_t SuspendMs;    // the device would be stopped after this long paused
+	uint32_t Pauses;
+	uint32_t Resumes;
+};
+
+NULL_STREAM_STATE GetNullStreamState();
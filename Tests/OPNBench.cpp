@@ -0,0 +1,232 @@
+// OPNBench: renders fixed workloads through FillBuffer without a sound device and reports the throughput.
+// Usage: OPNBench [--seconds N] [--reps N] [--rate Hz] [--json] [--trace file] [workload...]
+// The OPN_CPU environment variable selects the code path (see OPN_SetCPUFeatureLevel).
+// --trace needs a build with OPN_TRACE and keeps the last events of the run (the ring buffers wrap around)
+
+#include "src/OPN_DLL.hpp"
+#include "src/audio/stream.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <numbers>
+#include <string_view>
+#include <vector>
+
+struct Workload {
+	const char *Name;
+	uint8_t Chips;
+	std::function<void(uint8_t ChipID)> Setup;
+};
+
+struct Result {
+	const char *Name;
+	uint8_t Chips;
+	uint64_t Frames;
+	double Seconds;    // best run
+	OPN_STATS Stats;
+};
+
+// Port/register of a channel (0-5) register, op is the slot in register order
+static uint16_t ChannelReg(uint8_t Channel, uint8_t Base, uint8_t Op = 0){
+	return static_cast<uint16_t>(((Channel / 3) << 8) | (Base + Op * 4 + Channel % 3));
+}
+
+static void KeyOn(uint8_t ChipID, uint8_t Channel){
+	OPN_Write(ChipID, 0x28, static_cast<uint8_t>(0xF0 | ((Channel / 3) << 2) | (Channel % 3)));
+}
+
+// Plain sustaining patch: fast attack, no decay, every algorithm in turn
+static void SetupPatch(uint8_t ChipID, uint8_t Channel, uint8_t SSGEG = 0x00, uint8_t AMOn = 0x00){
+	for(uint8_t Op = 0; Op < 4; Op++){
+		OPN_Write(ChipID, ChannelReg(Channel, 0x30, Op), static_cast<uint8_t>(0x01 + Op));  // DT/MUL
+		OPN_Write(ChipID, ChannelReg(Channel, 0x40, Op), static_cast<uint8_t>(0x08 + Op * 4));// TL
+		OPN_Write(ChipID, ChannelReg(Channel, 0x50, Op), 0x1F);                                // KS/AR
+		OPN_Write(ChipID, ChannelReg(Channel, 0x60, Op), static_cast<uint8_t>(AMOn | 0x04)); // AM/D1R
+		OPN_Write(ChipID, ChannelReg(Channel, 0x70, Op), 0x02);                                // D2R
+		OPN_Write(ChipID, ChannelReg(Channel, 0x80, Op), 0x2F);                                // SL/RR
+		OPN_Write(ChipID, ChannelReg(Channel, 0x90, Op), SSGEG);
+	}
+	static constexpr std::array<uint16_t, 6> Notes = {0x269, 0x2B5, 0x308, 0x33A, 0x39A, 0x3D2};
+	const uint16_t Block = static_cast<uint16_t>((3 + Channel % 2) << 11);
+	OPN_Write(ChipID, ChannelReg(Channel, 0xA4), static_cast<uint8_t>((Block | Notes[Channel]) >> 8));
+	OPN_Write(ChipID, ChannelReg(Channel, 0xA0), static_cast<uint8_t>(Notes[Channel] & 0xFF));
+	OPN_Write(ChipID, ChannelReg(Channel, 0xB0), static_cast<uint8_t>(((Channel % 4) << 3) | Channel));// FB/ALGO
+	OPN_Write(ChipID, ChannelReg(Channel, 0xB4), 0xC0);
+}
+
+static void SetupChord(uint8_t ChipID){
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		SetupPatch(ChipID, Channel);
+		KeyOn(ChipID, Channel);
+	}
+}
+
+static void SetupLFO(uint8_t ChipID){
+	OPN_Write(ChipID, 0x22, 0x0F);    // LFO on, fastest
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		SetupPatch(ChipID, Channel, 0x00, 0x80);
+		OPN_Write(ChipID, ChannelReg(Channel, 0xB4), 0xC0 | 0x30 | 0x07);    // max AMS/PMS
+		KeyOn(ChipID, Channel);
+	}
+}
+
+static void SetupSSGEG(uint8_t ChipID){
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		SetupPatch(ChipID, Channel, static_cast<uint8_t>(0x08 | Channel % 8));
+		for(uint8_t Op = 0; Op < 4; Op++){
+			OPN_Write(ChipID, ChannelReg(Channel, 0x60, Op), 0x1A);    // decay fast enough to keep the SSG-EG cycling
+		}
+		KeyOn(ChipID, Channel);
+	}
+}
+
+static std::vector<uint8_t> DACSound;
+
+static void SetupDAC(uint8_t ChipID){
+	for(uint8_t Channel = 0; Channel < 5; Channel++){
+		SetupPatch(ChipID, Channel);
+		KeyOn(ChipID, Channel);
+	}
+	OPN_Write(ChipID, 0x2B, 0x80);
+	PlayDACSample(ChipID, DACSound, 16000);
+}
+
+// Drops every 16th frame of the output into a checksum, so the renderer can't be optimized away
+static uint64_t Checksum;
+
+static double RenderFor(uint64_t Frames){
+	std::array<WAVE_16BS, 0x400> Buffer{};
+	auto Start = std::chrono::steady_clock::now();
+	for(uint64_t Done = 0; Done < Frames;){
+		auto Chunk = static_cast<uint32_t>(std::min<uint64_t>(Buffer.size(), Frames - Done));
+		FillBuffer(Buffer.data(), Chunk);
+		for(uint32_t i = 0; i < Chunk; i += 16){
+			Checksum = Checksum * 31 + static_cast<uint16_t>(Buffer[i].Left) + static_cast<uint16_t>(Buffer[i].Right);
+		}
+		Done += Chunk;
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+}
+
+// Part of the profiled callback time spent in one stage
+static double Share(uint64_t Ns, const OPN_STATS &Stats){
+	uint64_t Total = Stats.ProfiledChipNs + Stats.ProfiledResampleNs + Stats.ProfiledMixNs;
+	return Total ? static_cast<double>(Ns) / static_cast<double>(Total) : 0.0;
+}
+
+int main(int argc, char **argv){
+	double Seconds = 10.0;
+	uint32_t Reps = 3;
+	uint32_t Rate = 44100;
+	bool JSON = false;
+	const char *TraceFile = nullptr;
+	std::vector<std::string_view> Selected;
+	for(int i = 1; i < argc; i++){
+		std::string_view Arg = argv[i];
+		if(Arg == "--seconds" && i + 1 < argc){
+			Seconds = std::atof(argv[++i]);
+		}else if(Arg == "--reps" && i + 1 < argc){
+			Reps = std::max(1, std::atoi(argv[++i]));
+		}else if(Arg == "--rate" && i + 1 < argc){
+			Rate = static_cast<uint32_t>(std::atoi(argv[++i]));
+		}else if(Arg == "--json"){
+			JSON = true;
+		}else if(Arg == "--trace" && i + 1 < argc){
+			TraceFile = argv[++i];
+		}else if(Arg.starts_with("--")){
+			std::fprintf(stderr, "Usage: %s [--seconds N] [--reps N] [--rate Hz] [--json] [--trace file] [workload...]\n", argv[0]);
+			return 1;
+		}else{
+			Selected.push_back(Arg);
+		}
+	}
+
+	// a DAC sample long enough to play through the whole measurement
+	DACSound.resize(static_cast<size_t>(16000 * (Seconds + 1.0)));
+	for(size_t i = 0; i < DACSound.size(); i++){
+		DACSound[i] = static_cast<uint8_t>(0x80 + 0x60 * std::sin(2.0 * std::numbers::pi * 220.0 * static_cast<double>(i) / 16000.0));
+	}
+
+	const std::array<Workload, 7> Workloads = {{
+		{"idle", 1, [](uint8_t) {}},
+		{"chords", 1, SetupChord},
+		{"lfo", 1, SetupLFO},
+		{"ssgeg", 1, SetupSSGEG},
+		{"dac", 1, SetupDAC},
+		{"16chips", 16, SetupChord},
+		{"64chips", 64, SetupChord},
+	}};
+
+	std::vector<Result> Results;
+	for(const auto &Load : Workloads){
+		if(!Selected.empty() && std::find(Selected.begin(), Selected.end(), Load.Name) == Selected.end()){
+			continue;
+		}
+		if(Load.Chips > GetMaxChipsSupported()){
+			std::fprintf(stderr, "%s: skipped, needs %u chips\n", Load.Name, Load.Chips);
+			continue;
+		}
+
+		SetOPNOptions(Rate);
+		if(auto RetVal = OpenOPNDriver(Load.Chips); RetVal != DriverReturnCode::Success){
+			std::fprintf(stderr, "%s: OpenOPNDriver failed (0x%02X)\n", Load.Name, static_cast<unsigned>(RetVal));
+			return static_cast<int>(RetVal);
+		}
+		for(uint8_t ChipID = 0; ChipID < Load.Chips; ChipID++){
+			Load.Setup(ChipID);
+		}
+
+		auto Frames = static_cast<uint64_t>(Seconds * Rate);
+		RenderFor(Rate / 10);    // warm up: caches, attack phase
+		double Best = INFINITY;
+		for(uint32_t Rep = 0; Rep < Reps; Rep++){
+			Best = std::min(Best, RenderFor(Frames));
+		}
+		OPN_STATS Stats;
+		OPN_GetStats(&Stats);
+		CloseOPNDriver();
+
+		Results.push_back({Load.Name, Load.Chips, Frames, Best, Stats});
+	}
+
+	constexpr std::array<const char *, 5> CPUNames = {"auto", "scalar", "sse4.1", "avx2", "avx512"};
+	const char *CPUName = CPUNames[static_cast<uint8_t>(OPN_GetCPUFeatureLevel())];
+
+	if(TraceFile != nullptr && !OPN_DumpTrace(TraceFile)){
+		std::fprintf(stderr, "Couldn't write %s (tracing needs a build with OPN_TRACE)\n", TraceFile);
+	}
+
+	if(JSON){
+		std::printf("{\n\t\"rate\": %u,\n\t\"seconds\": %g,\n\t\"reps\": %u,\n\t\"cpu\": \"%s\",\n\t\"checksum\": \"%016llx\",\n\t\"workloads\": [",
+		            Rate, Seconds, Reps, CPUName, static_cast<unsigned long long>(Checksum));
+		for(size_t i = 0; i < Results.size(); i++){
+			const auto &Res = Results[i];
+			double FramesPerSec = static_cast<double>(Res.Frames) / Res.Seconds;
+			std::printf("%s\n\t\t{\"name\": \"%s\", \"chips\": %u, \"frames\": %llu, \"ns_per_sample\": %.3f, "
+			            "\"samples_per_sec\": %.0f, \"realtime_factor\": %.2f, "
+			            "\"chip_share\": %.3f, \"resample_share\": %.3f, \"mix_share\": %.3f}",
+			            i ? "," : "", Res.Name, Res.Chips, static_cast<unsigned long long>(Res.Frames),
+			            1e9 / FramesPerSec, FramesPerSec, FramesPerSec / Rate,
+			            Share(Res.Stats.ProfiledChipNs, Res.Stats), Share(Res.Stats.ProfiledResampleNs, Res.Stats),
+			            Share(Res.Stats.ProfiledMixNs, Res.Stats));
+		}
+		std::printf("\n\t]\n}\n");
+	}else{
+		std::printf("code path: %s\n", CPUName);
+		std::printf("%-10s %5s %14s %14s %10s %6s %9s %6s\n", "workload", "chips", "ns/sample", "samples/sec", "realtime",
+		            "chip", "resample", "mix");
+		for(const auto &Res : Results){
+			double FramesPerSec = static_cast<double>(Res.Frames) / Res.Seconds;
+			std::printf("%-10s %5u %14.1f %14.0f %9.1fx %5.0f%% %8.0f%% %5.0f%%\n", Res.Name, Res.Chips, 1e9 / FramesPerSec,
+			            FramesPerSec, FramesPerSec / Rate, Share(Res.Stats.ProfiledChipNs, Res.Stats) * 100,
+			            Share(Res.Stats.ProfiledResampleNs, Res.Stats) * 100, Share(Res.Stats.ProfiledMixNs, Res.Stats) * 100);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,741 @@
+// OPNDriverTest: checks the parts of the driver around the chip core through its public API, rendering offline
+// through the device-less stream backend (OPN_OpenOffline/OPN_Render), so that it runs without a sound device.
+// Outputs are compared against a second render of the same material, or against what was recorded before a seek.
+// The renders of the resampling and mixing paths are hashed and compared against the golden file.
+// Usage: OPNDriverTest [<golden file> [--update]]
+//   --update  rewrites the golden file from the current output (only after intended output changes)
+
+#include "Tests/NullStream.hpp"
+#include "src/OPN_DLL.hpp"
+#include "src/audio/stream.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <numbers>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using Output = std::vector<int16_t>;    // L/R interleaved
+
+constexpr uint32_t PIECE_LENGTH = 512;    // frames per OPN_Render call, like a device callback
+constexpr uint16_t MIX_MAX_GAIN = 0x400;
+
+// channel 0-5, op in register order (S1, S3, S2, S4)
+static uint16_t Reg(uint8_t Channel, uint8_t Base, uint8_t Op = 0){
+	return static_cast<uint16_t>(((Channel / 3) << 8) | (Base + Op * 4 + Channel % 3));
+}
+
+static void KeyOn(uint8_t ChipID, uint8_t Channel, uint8_t Slots = 0x0F){
+	OPN_Write(ChipID, 0x28, static_cast<uint8_t>((Slots << 4) | ((Channel / 3) << 2) | (Channel % 3)));
+}
+
+// A chord on channels 0-4 with LFO, feedback and a different algorithm per channel
+static void PlayChord(uint8_t ChipID){
+	static constexpr std::array<uint16_t, 5> Notes = {0x269, 0x2B5, 0x308, 0x33A, 0x28E};
+	OPN_Write(ChipID, 0x22, 0x0B);
+	for(uint8_t Channel = 0; Channel < 5; Channel++){
+		for(uint8_t Op = 0; Op < 4; Op++){
+			OPN_Write(ChipID, Reg(Channel, 0x30, Op), static_cast<uint8_t>(((Op + Channel) % 8) << 4 | (0x01 + Op * 3 + Channel) % 16));
+			OPN_Write(ChipID, Reg(Channel, 0x40, Op), static_cast<uint8_t>(0x08 + Op * 7 + Channel * 2));
+			OPN_Write(ChipID, Reg(Channel, 0x50, Op), static_cast<uint8_t>((Op << 6) | (0x1F - Op * 2)));
+			OPN_Write(ChipID, Reg(Channel, 0x60, Op), static_cast<uint8_t>(0x86 + Op));
+			OPN_Write(ChipID, Reg(Channel, 0x70, Op), static_cast<uint8_t>(0x03 + Op));
+			OPN_Write(ChipID, Reg(Channel, 0x80, Op), static_cast<uint8_t>(((Op * 3) << 4) | (0x05 + Op * 2)));
+		}
+		OPN_Write(ChipID, Reg(Channel, 0xB0), static_cast<uint8_t>(((Channel + 2) << 3) | Channel));
+		OPN_Write(ChipID, Reg(Channel, 0xB4), static_cast<uint8_t>(0xC0 | (Channel % 4) << 4 | Channel));
+		OPN_Write(ChipID, Reg(Channel, 0xA4), static_cast<uint8_t>((3 + Channel % 3) << 3 | Notes[Channel] >> 8));
+		OPN_Write(ChipID, Reg(Channel, 0xA0), static_cast<uint8_t>(Notes[Channel] & 0xFF));
+		KeyOn(ChipID, Channel);
+	}
+}
+
+// 8 bit unsigned, as PlayDACSample takes it
+static std::vector<uint8_t> MakeSample(size_t Length, double Period){
+	std::vector<uint8_t> Sample(Length);
+	for(size_t Smpl = 0; Smpl < Length; Smpl++){
+		double Decay = 1.0 - static_cast<double>(Smpl) / static_cast<double>(Length);
+		Sample[Smpl] = static_cast<uint8_t>(0x80 + 0x70 * Decay * std::sin(2.0 * std::numbers::pi * static_cast<double>(Smpl) / Period));
+	}
+	return Sample;
+}
+
+static Output Render(uint32_t Frames, void (*Pull)(int16_t *, uint32_t) = OPN_Render){
+	Output Out(static_cast<size_t>(Frames) * 2);
+	for(uint32_t Frame = 0; Frame < Frames; Frame += PIECE_LENGTH){
+		Pull(&Out[static_cast<size_t>(Frame) * 2], std::min(PIECE_LENGTH, Frames - Frame));
+	}
+	return Out;
+}
+
+static bool Silent(const Output &Out){
+	return std::ranges::all_of(Out, [](int16_t Smpl) { return Smpl == 0; });
+}
+
+static bool Fail(const char *Reason){
+	std::printf("\t\t%s\n", Reason);
+	return false;
+}
+
+static bool Open(uint32_t Rate, uint8_t Chips = 1){
+	SetOPNOptions(Rate);
+	return OPN_OpenOffline(Chips) == DriverReturnCode::Success;
+}
+
+// Save, render, load, render again: both renders have to match bit for bit, at every resampler
+static bool StateRoundTrip(){
+	const std::vector<uint8_t> Sample = MakeSample(6000, 37.0);
+	for(uint32_t Rate : {44100u, OPN_CHIP_RATE, 22050u}){
+		if(!Open(Rate)){
+			return Fail("can't open the driver");
+		}
+		PlayChord(0);
+		OPN_Write(0, 0x2B, 0x80);
+		PlayDACSample(0, Sample.size(), Sample.data(), 11025);
+		Render(1234);
+
+		std::vector<uint8_t> State(OPN_GetStateSize());
+		bool Saved = OPN_SaveState(0, State.data(), State.size()) == StateReturnCode::Success;
+		Output First = Render(5000);
+		bool Loaded = OPN_LoadState(0, State.data(), State.size()) == StateReturnCode::Success;
+		bool Resumed = OPN_ResumeDACSample(0, Sample.data(), Sample.size()) == StateReturnCode::Success;
+		Output Second = Render(5000);
+		CloseOPNDriver();
+
+		if(!Saved || !Loaded || !Resumed){
+			return Fail("saving, loading or resuming the DAC sample failed");
+		}
+		if(First != Second || Silent(First)){
+			return Fail("output after loading differs");
+		}
+	}
+	return true;
+}
+
+// Snapshots can come from anywhere: damaged ones have to be rejected, or at least must not break rendering
+static bool StateValidation(){
+	if(!Open(44100)){
+		return Fail("can't open the driver");
+	}
+	PlayChord(0);
+	Render(700);
+	std::vector<uint8_t> State(OPN_GetStateSize());
+	OPN_SaveState(0, State.data(), State.size());
+
+	bool Ok = OPN_LoadState(0, State.data(), State.size() - 1) == StateReturnCode::BufferTooSmall
+	          && OPN_LoadState(1, State.data(), State.size()) == StateReturnCode::InvalidChip
+	          && OPN_ResumeDACSample(0, State.data(), State.size()) == StateReturnCode::BadState;    // no sample was playing
+	std::vector<uint8_t> Damaged = State;
+	Damaged[0] ^= 0xFF;
+	Ok = Ok && OPN_LoadState(0, Damaged.data(), Damaged.size()) == StateReturnCode::BadState;
+	std::fill(Damaged.begin() + 16, Damaged.end(), 0xFF);    // everything after the header
+	std::memcpy(Damaged.data(), State.data(), 16);
+	Ok = Ok && OPN_LoadState(0, Damaged.data(), Damaged.size()) != StateReturnCode::Success;
+	if(!Ok){
+		CloseOPNDriver();
+		return Fail("a damaged snapshot wasn't rejected");
+	}
+
+	// any single damaged byte, whatever gets accepted has to render
+	for(size_t Offset = 16; Offset < State.size(); Offset++){
+		for(uint8_t Value : {uint8_t{0xFF}, uint8_t{0x80}}){
+			Damaged = State;
+			Damaged[Offset] = Value;
+			if(OPN_LoadState(0, Damaged.data(), Damaged.size()) == StateReturnCode::Success){
+				Render(64);
+			}
+		}
+	}
+	Ok = OPN_LoadState(0, State.data(), State.size()) == StateReturnCode::Success;
+	CloseOPNDriver();
+	return Ok || Fail("the original snapshot isn't accepted anymore");
+}
+
+// What a host does between buffers: note changes, DAC samples from buffers it frees right away, mute changes
+static void Perform(uint32_t Piece){
+	if(Piece % 16 == 5){
+		uint8_t Channel = Piece / 16 % 5;
+		OPN_Write(0, Reg(Channel, 0xA4), static_cast<uint8_t>(0x20 | (Piece & 0x03)));
+		OPN_Write(0, Reg(Channel, 0xA0), static_cast<uint8_t>(Piece * 7));
+	}
+	if(Piece == 20 || Piece == 140){
+		const std::vector<uint8_t> Sample = MakeSample(4000 + Piece, 23.0);
+		OPN_Write(0, 0x2B, 0x80);
+		PlayDACSample(0, Sample.size(), Sample.data(), 8000);
+	}
+	switch(Piece){
+		case 60: OPN_Mute(0, 0x02); break;
+		case 90: OPN_Mute(0, 0x00); break;
+		case 110: OPN_Write(0, 0x28, 0x01); break;
+		case 111: KeyOn(0, 1); break;
+		case 130: SetDACVolume(0, 0x80); break;
+		case 145: SetDACFrequency(0, 9500); break;
+		default: break;
+	}
+}
+
+static Output Perform(uint32_t FirstPiece, uint32_t Pieces){
+	Output Out;
+	for(uint32_t Piece = FirstPiece; Piece < FirstPiece + Pieces; Piece++){
+		Perform(Piece);
+		Output Part = Render(PIECE_LENGTH);
+		Out.insert(Out.end(), Part.begin(), Part.end());
+	}
+	return Out;
+}
+
+static bool SameTail(const Output &Recorded, uint64_t Frame, const Output &Replayed){
+	return Replayed.size() == Recorded.size() - Frame * 2 && std::equal(Replayed.begin(), Replayed.end(), Recorded.begin() + static_cast<ptrdiff_t>(Frame * 2));
+}
+
+// Render A to B, seek back somewhere in between and play on: the recording has to come out the same,
+// including the DAC samples the host already freed
+static bool SeekReplay(){
+	constexpr uint32_t PIECES = 200;
+	for(uint32_t Rate : {44100u, OPN_CHIP_RATE}){
+		if(!Open(Rate)){
+			return Fail("can't open the driver");
+		}
+		OPN_SetKeyframeInterval(1);
+		PlayChord(0);
+		const Output Recorded = Perform(0, PIECES);
+		uint64_t Length = OPN_GetLength();
+
+		bool Ok = Length == PIECES * PIECE_LENGTH;
+		for(uint64_t Frame : {uint64_t{0}, uint64_t{25 * PIECE_LENGTH + 99}, uint64_t{Rate + 1}, uint64_t{150 * PIECE_LENGTH - 3}}){
+			Ok = Ok && OPN_Seek(Frame) == StateReturnCode::Success
+			     && SameTail(Recorded, Frame, Render(static_cast<uint32_t>(Length - Frame)))
+			     && OPN_GetLength() == Length;    // playing the recording doesn't change it
+		}
+		Ok = Ok && OPN_Seek(Length + 1) == StateReturnCode::OutOfRange;
+		CloseOPNDriver();
+		if(!Ok){
+			return Fail("the output after seeking back differs from the recording");
+		}
+	}
+	return true;
+}
+
+// After a seek back, the first thing the host does replaces whatever was recorded after it
+static bool SeekTrim(){
+	if(!Open(44100)){
+		return Fail("can't open the driver");
+	}
+	OPN_SetKeyframeInterval(1);
+	PlayChord(0);
+	Perform(0, 120);
+
+	constexpr uint64_t FRAME = 70 * PIECE_LENGTH + 5;
+	bool Ok = OPN_Seek(FRAME) == StateReturnCode::Success;
+	Render(300);
+	Ok = Ok && OPN_GetLength() == 120 * PIECE_LENGTH;    // still playing back
+	OPN_Write(0, 0x28, 0x00);
+	Ok = Ok && OPN_GetLength() == FRAME + 300 && OPN_GetPosition() == FRAME + 300;
+	Output Changed = Perform(200, 40);
+
+	// the new take is what gets replayed now
+	Ok = Ok && OPN_Seek(FRAME + 300) == StateReturnCode::Success && Render(40 * PIECE_LENGTH) == Changed;
+
+	// so does loading a snapshot, it starts the recording over
+	std::vector<uint8_t> State(OPN_GetStateSize());
+	OPN_SaveState(0, State.data(), State.size());
+	Ok = Ok && OPN_LoadState(0, State.data(), State.size()) == StateReturnCode::Success
+	     && OPN_GetLength() == OPN_GetPosition() && OPN_Seek(FRAME) == StateReturnCode::OutOfRange;
+	CloseOPNDriver();
+	return Ok || Fail("the recording after the seek wasn't replaced");
+}
+
+// Busy hosts fill the journal: the oldest part of the history goes, the recent part still seeks exactly
+static bool SeekBounded(){
+	if(!Open(44100)){
+		return Fail("can't open the driver");
+	}
+	OPN_SetKeyframeInterval(1);
+	PlayChord(0);
+	Output Recorded;
+	for(uint32_t Piece = 0; Piece < 100; Piece++){
+		for(uint32_t Write = 0; Write < 500; Write++){
+			OPN_Write(0, Reg(0, 0x40, 3), static_cast<uint8_t>((Piece + Write) & 0x0F));
+		}
+		Output Part = Render(PIECE_LENGTH);
+		Recorded.insert(Recorded.end(), Part.begin(), Part.end());
+	}
+
+	constexpr uint64_t FRAME = 97 * PIECE_LENGTH + 11;
+	bool Ok = OPN_Seek(0) == StateReturnCode::OutOfRange
+	          && OPN_Seek(FRAME) == StateReturnCode::Success
+	          && SameTail(Recorded, FRAME, Render(static_cast<uint32_t>(100 * PIECE_LENGTH - FRAME)));
+	CloseOPNDriver();
+	return Ok || Fail("the history isn't bounded, or its recent part doesn't seek exactly");
+}
+
+// Timer flags show up in the status on the exact sample the counter runs out, bits 4 and 5 of 0x27 clear them.
+// At the chip rate every output frame is one chip sample.
+static bool TimerStatus(){
+	if(!Open(OPN_CHIP_RATE)){
+		return Fail("can't open the driver");
+	}
+	OPN_Write(0, 0x24, 0xE7);    // Timer A = 0x39C: 100 samples
+	OPN_Write(0, 0x25, 0x00);
+	OPN_Write(0, 0x26, 0xF0);    // Timer B = 0xF0: 16 * 16 = 256 samples
+	OPN_Write(0, 0x27, 0x0F);    // load and flag both
+
+	auto Flags = [] { return OPN_ReadStatus(0) & 0x03; };
+	bool Ok = Flags() == 0x00;
+	Render(99);
+	Ok = Ok && Flags() == 0x00;
+	Render(1);
+	Ok = Ok && Flags() == 0x01;
+	OPN_Write(0, 0x27, 0x1F);    // reset A, keep both running
+	Ok = Ok && Flags() == 0x00;
+	Render(155);
+	Ok = Ok && Flags() == 0x01;    // A overflowed again at 200, B not yet
+	OPN_Write(0, 0x27, 0x1F);
+	Render(1);
+	Ok = Ok && Flags() == 0x02;
+	OPN_Write(0, 0x27, 0x2F);    // reset B
+	Ok = Ok && Flags() == 0x00;
+	Render(255);
+	Ok = Ok && Flags() == 0x01;    // A at 300, 400 and 500, B next at 512
+	OPN_Write(0, 0x27, 0x1F);
+	Render(1);
+	Ok = Ok && Flags() == 0x02;
+	OPN_Write(0, 0x27, 0x30);    // stop and reset both
+	Render(1000);
+	Ok = Ok && Flags() == 0x00;
+	CloseOPNDriver();
+	return Ok || Fail("timer flags at the wrong sample, or not cleared");
+}
+
+struct TickLog {
+	std::vector<uint64_t> Frames;
+	uint64_t MuteAt;    // the callback mutes chip 0 through the mix bus on that frame
+};
+
+static void LogTick(void *User, uint64_t Frame){
+	auto *Log = static_cast<TickLog *>(User);
+	Log->Frames.push_back(Frame);
+	if(Frame == Log->MuteAt){
+		OPN_SetChipMix(0, 0x00, 0);
+	}
+}
+
+// Ticks on Timer B fire on the frame it overflows, and whatever the callback changes applies from that very frame
+static bool TickTiming(){
+	if(!Open(OPN_CHIP_RATE)){
+		return Fail("can't open the driver");
+	}
+	PlayChord(0);
+	OPN_Write(0, 0x26, 0xF0);    // 16 * 16 = 256 samples
+	OPN_Write(0, 0x27, 0x0A);
+	TickLog Log{{}, 3 * 256};
+	OPN_SetTickCallback(LogTick, &Log, 0);
+	Output Out = Render(1000);
+	OPN_SetTickCallback(nullptr, nullptr, 0);
+	CloseOPNDriver();
+
+	const Output Before(Out.begin(), Out.begin() + 3 * 256 * 2);
+	const Output After(Out.begin() + 3 * 256 * 2, Out.end());
+	if(Log.Frames != std::vector<uint64_t>{256, 512, 768}){
+		return Fail("ticks off the Timer B overflows");
+	}
+	return (!Silent(Before) && Silent(After)) || Fail("the mix change from the tick didn't apply on its frame");
+}
+
+// Known render for the counters: the chord on one chip at the chip rate, in 512-frame callbacks
+static bool StatsCounters(){
+	constexpr uint64_t CHORD_WRITES = 1 + 5 * (4 * 6 + 5);    // LFO, per channel: operators, 0xB0/0xB4/0xA4/0xA0, key on
+	if(!Open(OPN_CHIP_RATE)){
+		return Fail("can't open the driver");
+	}
+	PlayChord(0);
+	Render(5000);
+
+	OPN_STATS Stats;
+	OPN_CHIP_STATS Chip;
+	OPN_GetStats(&Stats);
+	bool Ok = OPN_GetChipStats(0, &Chip) == StateReturnCode::Success
+	          && OPN_GetChipStats(1, &Chip) == StateReturnCode::InvalidChip;
+	OPN_GetChipStats(0, &Chip);
+	uint64_t Histogram = 0;
+	for(uint64_t Bucket : Stats.CallbackHistogram){
+		Histogram += Bucket;
+	}
+	Ok = Ok && Stats.Callbacks == 10 && Stats.Frames == 5000 && Stats.Writes == CHORD_WRITES && Stats.CallbackMaxFrames == 512
+	     && Stats.PausedCallbacks == 0 && Stats.ProfiledCallbacks == 1 && Histogram == Stats.Callbacks
+	     && Chip.Samples == 5000 && Chip.SkippedSamples == 0 && Chip.Writes == CHORD_WRITES && Chip.QueueMaxSamples == 0;
+	if(!Ok){
+		CloseOPNDriver();
+		return Fail("counters don't match the render");
+	}
+
+	OPN_ResetStats();
+	OPN_GetStats(&Stats);
+	OPN_GetChipStats(0, &Chip);
+	Ok = Stats.Callbacks == 0 && Stats.Frames == 0 && Stats.Writes == 0 && Stats.CallbackNs == 0 && Stats.CallbackMaxFrames == 0
+	     && Chip.Samples == 0 && Chip.Writes == 0;
+	CloseOPNDriver();
+	return Ok || Fail("OPN_ResetStats left counters behind");
+}
+
+// A chip run by OPN_RunCycles: silent until its queue fills up to the latency, then counted in and out of it
+static bool RunCycles(){
+	constexpr uint32_t CYCLES_PER_SAMPLE = 144;
+	constexpr uint64_t QUEUE_SIZE = 0x2000;
+	if(!Open(OPN_CHIP_RATE)){
+		return Fail("can't open the driver");
+	}
+	PlayChord(0);
+	OPN_SetQueueLatency(1000);
+	OPN_RunCycles(0, CYCLES_PER_SAMPLE * 500 + 100);
+	bool Ok = Silent(Render(512));    // not primed yet, holds the (zero) last sample
+	OPN_RunCycles(0, CYCLES_PER_SAMPLE * 600 - 100);
+	OPN_CHIP_STATS Chip;
+	OPN_GetChipStats(0, &Chip);
+	Ok = Ok && Chip.Samples == 1100 && Chip.QueueMaxSamples == 1100 && Chip.QueueUnderruns == 0;
+
+	Ok = Ok && !Silent(Render(2048));    // plays the 1100 samples, then runs dry
+	OPN_GetChipStats(0, &Chip);
+	Ok = Ok && Chip.QueueUnderruns > 0 && Chip.QueueOverruns == 0;
+
+	OPN_RunCycles(0, CYCLES_PER_SAMPLE * (QUEUE_SIZE + 300));
+	OPN_GetChipStats(0, &Chip);
+	Ok = Ok && Chip.QueueOverruns == 300 && Chip.QueueMaxSamples == QUEUE_SIZE && Chip.Samples == 1100 + QUEUE_SIZE + 300;
+	CloseOPNDriver();
+	return Ok || Fail("queue output or counters are off");
+}
+
+// Two chips, the chord on one, a DAC sample on the other, rendered with the mix Setup applies
+static Output RenderMix(const std::function<void()> &Setup){
+	if(!Open(44100, 2)){
+		return {};
+	}
+	const std::vector<uint8_t> Sample = MakeSample(12000, 61.0);
+	PlayChord(0);
+	OPN_Write(1, 0x2B, 0x80);
+	PlayDACSample(1, Sample.size(), Sample.data(), 16000);
+	Setup();
+	Output Out = Render(16384);
+	CloseOPNDriver();
+	return Out;
+}
+
+// Unity gain and center pan take the plain path and have to match the default mix bit for bit
+static bool MixUnity(){
+	const Output Default = RenderMix([] {});
+	const Output Unity = RenderMix([] {
+		OPN_SetChipMix(0, 0x100, 0);
+		OPN_SetChipMix(1, 0x100, 0);
+		OPN_SetChipMix(2, 0x00, 0);    // no such chip, ignored
+	});
+	const Output Muted = RenderMix([] {
+		OPN_SetChipMix(0, 0x00, 0);
+		OPN_SetChipMix(1, 0x00, 0);
+	});
+	if(Silent(Default) || Unity != Default){
+		return Fail("unity gain doesn't match the default mix");
+	}
+	return Silent(Muted) || Fail("gain 0 isn't silent");
+}
+
+// All six channels on four carriers at full level, in phase: the loudest a chip gets
+static void PlayFullScale(uint8_t ChipID){
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		for(uint8_t Op = 0; Op < 4; Op++){
+			OPN_Write(ChipID, Reg(Channel, 0x30, Op), 0x01);
+			OPN_Write(ChipID, Reg(Channel, 0x40, Op), 0x00);
+			OPN_Write(ChipID, Reg(Channel, 0x50, Op), 0x1F);
+			OPN_Write(ChipID, Reg(Channel, 0x80, Op), 0x0F);
+		}
+		OPN_Write(ChipID, Reg(Channel, 0xB0), 0x07);
+		OPN_Write(ChipID, Reg(Channel, 0xB4), 0xC0);
+		OPN_Write(ChipID, Reg(Channel, 0xA4), 0x22);
+		OPN_Write(ChipID, Reg(Channel, 0xA0), 0x69);
+		KeyOn(ChipID, Channel);
+	}
+}
+
+static Output RenderFullScale(uint8_t Chips, uint16_t Gain = 0x100){
+	if(!Open(44100, Chips)){
+		return {};
+	}
+	for(uint8_t ChipID = 0; ChipID < Chips; ChipID++){
+		PlayFullScale(ChipID);
+		OPN_SetChipMix(ChipID, Gain, static_cast<int8_t>(ChipID % 3 * 40 - 40));
+	}
+	Output Out = Render(4096);
+	CloseOPNDriver();
+	return Out;
+}
+
+// As many chips as there can be at full scale overflow the 32 bit bus, it has to clip instead of wrapping around
+static bool MixHeadroom(){
+	const Output One = RenderFullScale(1);
+	const Output All = RenderFullScale(0xFF);
+	if(Silent(One) || All.size() != One.size()){
+		return Fail("nothing rendered");
+	}
+	for(size_t Smpl = 0; Smpl < One.size(); Smpl++){
+		if((One[Smpl] > 0 && All[Smpl] < One[Smpl]) || (One[Smpl] < 0 && All[Smpl] > One[Smpl])){
+			return Fail("the bus wrapped around");
+		}
+	}
+	return true;
+}
+
+// One chip at full scale at the chip rate, clipped straight from its own buffers instead of the bus.
+// Half the channels hard left, half hard right, so swapped sides show. The odd length leaves a few frames
+// for the scalar tail of the vector kernels.
+static Output RenderDirect(){
+	if(!Open(OPN_CHIP_RATE)){
+		return {};
+	}
+	PlayFullScale(0);
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		OPN_Write(0, Reg(Channel, 0xB4), Channel < 4 ? 0x80 : 0x40);
+	}
+	Output Out = Render(4099);
+	CloseOPNDriver();
+	return Out;
+}
+
+// Every code path mixes and clips the same samples, the saturating ones included
+static bool MixCPULevels(){
+	Output Reference;
+	for(CPUFeatureLevel Level : {CPUFeatureLevel::Scalar, CPUFeatureLevel::SSE41, CPUFeatureLevel::AVX2, CPUFeatureLevel::AVX512}){
+		OPN_SetCPUFeatureLevel(Level);
+		Output Out = RenderMix([] {
+			OPN_SetChipMix(0, 0xC0, -90);
+			OPN_SetChipMix(1, 0x200, 60);
+		});
+		Output Loud = RenderFullScale(48, MIX_MAX_GAIN);
+		Out.insert(Out.end(), Loud.begin(), Loud.end());
+		Output Direct = RenderDirect();
+		Out.insert(Out.end(), Direct.begin(), Direct.end());
+		if(Reference.empty()){
+			Reference = Out;
+		}else if(Out != Reference){
+			OPN_SetCPUFeatureLevel(CPUFeatureLevel::Auto);
+			return Fail("the code paths mix differently");
+		}
+	}
+	OPN_SetCPUFeatureLevel(CPUFeatureLevel::Auto);
+	return !Silent(Reference) || Fail("nothing rendered");
+}
+
+static uint64_t PausedCallbacks(){
+	OPN_STATS Stats;
+	OPN_GetStats(&Stats);
+	return Stats.PausedCallbacks;
+}
+
+// With a sound device (the null backend here, the test pulls the buffers), the output pauses as soon as a DAC
+// sample ends on a chip without any notes, instead of after IdlePauseMs of silence
+static bool PauseIdleChips(){
+	constexpr uint32_t RATE = 44100;
+	SetOPNOptions(RATE);
+	if(OpenOPNDriver(1) != DriverReturnCode::Success){
+		return Fail("can't open the driver");
+	}
+	const std::vector<uint8_t> Sample = MakeSample(4000, 29.0);    // 250 ms
+	OPN_Write(0, 0x2B, 0x80);
+	PlayDACSample(0, Sample.size(), Sample.data(), 16000);
+	std::array<WAVE_16BS, PIECE_LENGTH> Buffer;
+	uint32_t Frames = 0;
+	for(; PausedCallbacks() == 0 && Frames < 2 * RATE; Frames += PIECE_LENGTH){
+		FillBuffer(Buffer.data(), PIECE_LENGTH);
+	}
+	CloseOPNDriver();
+	return (Frames > RATE / 4 && Frames < RATE / 4 + RATE / 10) || Fail("didn't pause right after the sample");
+}
+
+// On the null backend: paused until the first key on, paused again with IdleSuspendMs for the device once the DAC
+// sample ends, resumed by the next key on. The output rendered ahead on resume is the same as without it.
+static Output PauseResume(bool Prerender){
+	constexpr uint32_t RATE = 44100;
+	SetOPNOptions(RATE);
+	OPN_SetIdleTimeouts(1000, 300);
+	if(OpenOPNDriver(1) != DriverReturnCode::Success){
+		return {};
+	}
+	NULL_STREAM_STATE Opened = GetNullStreamState();
+	const std::vector<uint8_t> Sample = MakeSample(2000, 29.0);
+	OPN_Write(0, 0x2B, 0x80);
+	PlayDACSample(0, Sample.size(), Sample.data(), 16000);
+	NULL_STREAM_STATE Playing = GetNullStreamState();
+
+	std::array<WAVE_16BS, PIECE_LENGTH> Buffer;
+	for(uint32_t Frames = 0; !GetNullStreamState().Paused && Frames < RATE; Frames += PIECE_LENGTH){
+		FillBuffer(Buffer.data(), PIECE_LENGTH);
+	}
+	NULL_STREAM_STATE Idle = GetNullStreamState();
+	PlayChord(0);
+	NULL_STREAM_STATE Resumed = GetNullStreamState();
+	if(Prerender){
+		PrerenderBuffer(3 * PIECE_LENGTH / 2);    // what a backend restarting the device does
+	}
+	Output Out = Render(4 * PIECE_LENGTH, [](int16_t *Piece, uint32_t Frames) { FillBuffer(reinterpret_cast<WAVE_16BS *>(Piece), Frames); });
+	CloseOPNDriver();
+	OPN_SetIdleTimeouts(1000, 5000);
+
+	bool Ok = Opened.Paused && Opened.SuspendMs == 300 && !Playing.Paused && Playing.Resumes == 1
+	          && Idle.Paused && Idle.Pauses == 2 && Idle.SuspendMs == 300 && !Resumed.Paused && Resumed.Resumes == 2;
+	return Ok ? Out : Output{};
+}
+
+static bool PauseSuspendResume(){
+	const Output Direct = PauseResume(false);
+	const Output Prerendered = PauseResume(true);
+	if(Direct.empty() || Silent(Direct)){
+		return Fail("pause or resume didn't reach the backend");
+	}
+	return Prerendered == Direct || Fail("the output rendered ahead differs");
+}
+
+struct Check {
+	std::string Name;
+	std::function<bool()> Run;
+};
+
+// Renders checked against the golden file
+struct Case {
+	std::string Name;
+	std::function<Output()> Render;
+};
+
+static Output RenderRate(uint32_t Rate){
+	if(!Open(Rate)){
+		return {};
+	}
+	const std::vector<uint8_t> Sample = MakeSample(6000, 37.0);
+	PlayChord(0);
+	OPN_Write(0, 0x2B, 0x80);
+	PlayDACSample(0, Sample.size(), Sample.data(), 11025);
+	Output Out = Render(16384);
+	CloseOPNDriver();
+	return Out;
+}
+
+static std::vector<Case> Cases(){
+	return {
+			{"offline_44100", [] { return RenderRate(44100); }},
+			{"offline_chip_rate", [] { return RenderRate(OPN_CHIP_RATE); }},
+			{"offline_22050", [] { return RenderRate(22050); }},
+			{"offline_96000", [] { return RenderRate(96000); }},
+			{"mix_default", [] { return RenderMix([] {}); }},
+			{"mix_pan_gain", [] {
+				 return RenderMix([] {
+					 OPN_SetChipMix(0, 0xC0, -90);
+					 OPN_SetChipMix(1, 0x200, 60);
+				 });
+			 }},
+	};
+}
+
+static uint64_t Hash(const Output &Out){
+	uint64_t Value = 0xCBF29CE484222325ull;    // FNV-1a
+	for(int16_t Smpl : Out){
+		Value ^= static_cast<uint16_t>(Smpl);
+		Value *= 0x100000001B3ull;
+	}
+	return Value;
+}
+
+static std::map<std::string, uint64_t> LoadGolden(const char *Path){
+	std::map<std::string, uint64_t> Golden;
+	std::ifstream File(Path);
+	std::string Line;
+	while(std::getline(File, Line)){
+		if(Line.empty() || Line[0] == '#'){
+			continue;
+		}
+		std::istringstream Fields(Line);
+		std::string Name, Value;
+		if(Fields >> Name >> Value){
+			Golden[Name] = std::stoull(Value, nullptr, 16);
+		}
+	}
+	return Golden;
+}
+
+static std::vector<Check> Checks(){
+	return {
+			{"state_roundtrip", StateRoundTrip},
+			{"state_validation", StateValidation},
+			{"seek_replay", SeekReplay},
+			{"seek_trim", SeekTrim},
+			{"seek_bounded", SeekBounded},
+			{"timer_status", TimerStatus},
+			{"tick_timing", TickTiming},
+			{"stats_counters", StatsCounters},
+			{"run_cycles", RunCycles},
+			{"mix_unity", MixUnity},
+			{"mix_headroom", MixHeadroom},
+			{"mix_cpu_levels", MixCPULevels},
+			{"pause_idle_chips", PauseIdleChips},
+			{"pause_suspend_resume", PauseSuspendResume},
+	};
+}
+
+int main(int argc, char **argv){
+	const char *GoldenFile = argc > 1 ? argv[1] : nullptr;
+	const bool Update = argc > 2 && !std::strcmp(argv[2], "--update");
+
+	int Failures = 0;
+	if(!Update){
+		for(const auto &Test : Checks()){
+			if(Test.Run()){
+				std::printf("\t%-20s ok\n", Test.Name.c_str());
+			}else{
+				std::printf("\t%-20s FAILED\n", Test.Name.c_str());
+				Failures++;
+			}
+		}
+	}
+
+	if(GoldenFile != nullptr){
+		auto Golden = LoadGolden(GoldenFile);
+		std::ostringstream NewGolden;
+		NewGolden << "# libOPN driver golden output, regenerate with: OPNDriverTest OPNDriverTest.txt --update\n"
+		          << "# case, hash of all frames\n";
+		for(const auto &Test : Cases()){
+			uint64_t Value = Hash(Test.Render());
+			char Hex[17];
+			std::snprintf(Hex, sizeof(Hex), "%016llx", static_cast<unsigned long long>(Value));
+			NewGolden << Test.Name << ' ' << Hex << '\n';
+			if(Update){
+				continue;
+			}
+
+			auto Expected = Golden.find(Test.Name);
+			if(Expected == Golden.end()){
+				std::printf("\t%-20s MISSING from %s\n", Test.Name.c_str(), GoldenFile);
+				Failures++;
+			}else if(Expected->second != Value){
+				std::printf("\t%-20s MISMATCH (%s)\n", Test.Name.c_str(), Hex);
+				Failures++;
+			}else{
+				std::printf("\t%-20s ok\n", Test.Name.c_str());
+			}
+		}
+		if(Update){
+			std::ofstream(GoldenFile) << NewGolden.str();
+			std::printf("%s updated\n", GoldenFile);
+			return 0;
+		}
+	}
+
+	if(Failures){
+		std::printf("%d check(s) failed\n", Failures);
+		return 1;
+	}
+	std::printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,404 @@
+// OPNGolden: renders scripted register sequences through the YM2612 core and compares the output against
+// the hashes in OPNGolden.txt, so that changes to the renderer can't alter the sound unnoticed.
+// All SIMD paths the CPU supports are checked.
+// Usage: OPNGolden <golden file> [--update] [--dump <dir>]
+//   --update  rewrites the golden file from the current output (only after intended output changes)
+//   --dump    writes the raw output of every case (int32 L/R interleaved) to <dir>/<case>.raw,
+//             use it with a known-good build to compare against the files written on a mismatch
+
+#include "src/ym2612/fm2612.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <numbers>
+#include <sstream>
+#include <string>
+#include <vector>
+
+stream_sample_t *DUMMYBUF[0x02] = {nullptr, nullptr};
+
+namespace fs = std::filesystem;
+
+constexpr int YM2612_CLOCK = 7670454;
+constexpr std::array<const char *, 5> ISANames = {"", "scalar", "sse4.1", "avx2", "avx512"};
+constexpr uint32_t CASE_LENGTH = 0x8000;    // chip samples per case
+constexpr uint32_t CHUNK_LENGTH = 0x1000;   // samples per partial hash, narrows down where a mismatch starts
+
+struct RegWrite {
+	uint32_t Sample;
+	uint16_t Register;    // 0x1xx = port 1
+	uint8_t Data;
+};
+
+class Script {
+public:
+	uint32_t Time = 0;
+	std::vector<RegWrite> Writes;
+
+	void Write(uint16_t Register, uint8_t Data){
+		Writes.push_back({Time, Register, Data});
+	}
+	void At(uint32_t Sample){
+		Time = Sample;
+	}
+
+	// channel 0-5, op in register order (S1, S3, S2, S4)
+	static uint16_t Reg(uint8_t Channel, uint8_t Base, uint8_t Op = 0){
+		return static_cast<uint16_t>(((Channel / 3) << 8) | (Base + Op * 4 + Channel % 3));
+	}
+	void Key(uint8_t Channel, uint8_t Slots){
+		Write(0x28, static_cast<uint8_t>((Slots << 4) | ((Channel / 3) << 2) | (Channel % 3)));
+	}
+	void Freq(uint8_t Channel, uint8_t Block, uint16_t FNum){
+		Write(Reg(Channel, 0xA4), static_cast<uint8_t>((Block << 3) | (FNum >> 8)));
+		Write(Reg(Channel, 0xA0), static_cast<uint8_t>(FNum & 0xFF));
+	}
+	void Patch(uint8_t Channel, uint8_t Algo, uint8_t FB, uint8_t SSGEG = 0x00, uint8_t AM = 0x00){
+		for(uint8_t Op = 0; Op < 4; Op++){
+			Write(Reg(Channel, 0x30, Op), static_cast<uint8_t>(((Op + Channel) % 8) << 4 | (0x01 + Op * 3 + Channel) % 16));
+			Write(Reg(Channel, 0x40, Op), static_cast<uint8_t>(0x04 + Op * 7 + Channel * 2));
+			Write(Reg(Channel, 0x50, Op), static_cast<uint8_t>((Op << 6) | (0x1F - Op * 2)));
+			Write(Reg(Channel, 0x60, Op), static_cast<uint8_t>(AM | (0x06 + Op)));
+			Write(Reg(Channel, 0x70, Op), static_cast<uint8_t>(0x03 + Op));
+			Write(Reg(Channel, 0x80, Op), static_cast<uint8_t>(((Op * 3) << 4) | (0x05 + Op * 2)));
+			Write(Reg(Channel, 0x90, Op), SSGEG);
+		}
+		Write(Reg(Channel, 0xB0), static_cast<uint8_t>((FB << 3) | Algo));
+		Write(Reg(Channel, 0xB4), 0xC0);
+	}
+};
+
+static constexpr std::array<uint16_t, 6> Notes = {0x269, 0x28E, 0x2B5, 0x2DE, 0x308, 0x33A};
+static constexpr std::array<uint8_t, 3> Pans = {0xC0, 0x80, 0x40};
+
+static Script Algorithm(uint8_t Algo){
+	Script S;
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		S.Patch(Channel, Algo, Channel);
+		S.Freq(Channel, static_cast<uint8_t>(2 + Channel % 4), Notes[Channel]);
+		S.Write(Script::Reg(Channel, 0xB4), Pans[Channel % 3]);
+		S.Key(Channel, 0x0F);
+	}
+	S.At(0x3000);
+	S.Freq(1, 5, 0x4D2);
+	S.Write(Script::Reg(4, 0x40, 3), 0x20);
+	S.At(0x5000);
+	for(uint8_t Channel = 0; Channel < 6; Channel += 2){
+		S.Key(Channel, 0x00);
+	}
+	S.At(0x6800);
+	S.Key(0, 0x0F);
+	return S;
+}
+
+static Script CSM(){
+	Script S;
+	S.Patch(2, 7, 3);
+	S.Freq(2, 4, 0x269);
+	S.Write(0xAD, 0x1A); S.Write(0xA9, 0x22);
+	S.Write(0xAE, 0x24); S.Write(0xAA, 0x80);
+	S.Write(0xAC, 0x2C); S.Write(0xA8, 0x44);
+	S.Write(0x24, 0xF0);    // Timer A
+	S.Write(0x25, 0x02);
+	S.Write(0x27, 0x85);    // CSM, load and enable Timer A
+	S.At(0x2000);
+	S.Key(2, 0x0F);
+	S.At(0x3000);
+	S.Key(2, 0x00);
+	S.At(0x5000);
+	S.Write(0x27, 0x05);    // back to normal mode
+	S.Key(2, 0x0F);
+	return S;
+}
+
+static Script ThreeSlot(){
+	Script S;
+	S.Patch(2, 7, 5);
+	S.Patch(0, 4, 2);
+	S.Freq(0, 4, 0x308);
+	S.Write(0x27, 0x40);
+	S.Freq(2, 3, 0x269);    // SLOT4
+	S.Write(0xAD, 0x1A); S.Write(0xA9, 0x22);    // SLOT1
+	S.Write(0xAE, 0x24); S.Write(0xAA, 0x80);    // SLOT3
+	S.Write(0xAC, 0x2C); S.Write(0xA8, 0x44);    // SLOT2
+	S.Key(0, 0x0F);
+	S.Key(2, 0x0F);
+	S.At(0x2800);
+	S.Write(0xAE, 0x33); S.Write(0xAA, 0x10);
+	S.At(0x4000);
+	S.Write(0x27, 0x00);    // 3 slot off while playing
+	S.At(0x6000);
+	S.Write(0x27, 0x40);
+	return S;
+}
+
+static Script SSGEG(){
+	Script S;
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		S.Patch(Channel, static_cast<uint8_t>(Channel + 1), 0, static_cast<uint8_t>(0x08 | Channel));
+		for(uint8_t Op = 0; Op < 4; Op++){
+			S.Write(Script::Reg(Channel, 0x60, Op), static_cast<uint8_t>(0x14 + Op * 2));
+		}
+		S.Freq(Channel, 4, Notes[Channel]);
+		S.Key(Channel, 0x0F);
+	}
+	S.At(0x4000);
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		S.Key(Channel, 0x00);
+		for(uint8_t Op = 0; Op < 4; Op++){
+			S.Write(Script::Reg(Channel, 0x90, Op), static_cast<uint8_t>(0x08 | ((Channel + 6 + Op) % 8)));
+		}
+	}
+	S.At(0x4800);
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		S.Key(Channel, 0x0F);
+	}
+	return S;
+}
+
+static Script LFO(uint8_t PMS, uint8_t AMS){
+	Script S;
+	S.Write(0x22, 0x0B);
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		S.Patch(Channel, static_cast<uint8_t>((Channel * 3) % 8), Channel % 2 ? 0 : 4, 0x00, AMS ? 0x80 : 0x00);
+		S.Freq(Channel, 4, Notes[Channel]);
+		S.Write(Script::Reg(Channel, 0xB4), static_cast<uint8_t>(0xC0 | (AMS << 4) | PMS));
+		S.Key(Channel, 0x0F);
+	}
+	S.At(0x2000);
+	S.Write(0x22, 0x0F);
+	S.At(0x4000);
+	S.Write(0x22, 0x09);
+	S.Write(Script::Reg(3, 0xB4), 0xC0 | 0x23);
+	S.At(0x6000);
+	S.Write(0x22, 0x00);    // LFO off, the phase is held
+	S.At(0x7000);
+	S.Write(0x22, 0x0C);
+	return S;
+}
+
+static Script DAC(){
+	Script S;
+	for(uint8_t Channel = 0; Channel < 6; Channel++){
+		S.Patch(Channel, static_cast<uint8_t>(Channel % 8), 3);
+		S.Freq(Channel, 3, Notes[Channel]);
+		S.Key(Channel, 0x0F);
+	}
+	S.Write(0x2B, 0x80);
+	for(uint32_t Sample = 0; Sample < 0x6000; Sample += 3){
+		S.At(Sample);
+		S.Write(0x2A, static_cast<uint8_t>(0x80 + 0x70 * std::sin(2.0 * std::numbers::pi * Sample / 240.0)));
+		if(Sample % 0x1000 == 0){
+			S.Write(0x1B6, Pans[Sample / 0x1000 % 3]);
+		}
+	}
+	S.At(0x6000);
+	S.Write(0x2B, 0x00);    // back to FM
+	return S;
+}
+
+struct Case {
+	std::string Name;
+	std::function<Script()> Build;
+};
+
+static std::vector<Case> Corpus(){
+	std::vector<Case> Cases;
+	for(uint8_t Algo = 0; Algo < 8; Algo++){
+		Cases.push_back({"algo" + std::to_string(Algo), [Algo]() { return Algorithm(Algo); }});
+	}
+	Cases.push_back({"csm", CSM});
+	Cases.push_back({"3slot", ThreeSlot});
+	Cases.push_back({"ssgeg", SSGEG});
+	Cases.push_back({"lfo_pm", []() { return LFO(7, 0); }});
+	Cases.push_back({"lfo_am", []() { return LFO(0, 3); }});
+	Cases.push_back({"lfo_pm_am", []() { return LFO(4, 2); }});
+	Cases.push_back({"dac", DAC});
+	return Cases;
+}
+
+static uint64_t Hash(uint64_t Value, int32_t Sample){
+	// FNV-1a
+	Value ^= static_cast<uint32_t>(Sample);
+	return Value * 0x100000001B3ull;
+}
+
+constexpr uint64_t HASH_INIT = 0xCBF29CE484222325ull;
+
+struct CaseResult {
+	uint64_t Total = HASH_INIT;
+	std::vector<uint64_t> Chunks;
+	std::vector<int32_t> Output;    // L/R interleaved
+};
+
+// Renders the script with ym2612_stream_update, split at every write and
+// into odd sized pieces in between, so that block boundaries move around
+static CaseResult Render(const Script &S){
+	constexpr std::array<uint32_t, 6> Pieces = {1, 7, 16, 33, 250, 1000};
+	std::vector<int32_t> Left(1000);
+	std::vector<int32_t> Right(1000);
+	int32_t *Buffers[0x02] = {Left.data(), Right.data()};
+
+	device_reset_ym2612(0);
+	CaseResult Result;
+	Result.Output.reserve(CASE_LENGTH * 2);
+	auto Write = S.Writes.begin();
+	uint32_t Piece = 0;
+	for(uint32_t Sample = 0; Sample < CASE_LENGTH;){
+		for(; Write != S.Writes.end() && Write->Sample <= Sample; ++Write){
+			uint8_t Port = (Write->Register >> 8) << 1;
+			ym2612_w(0, Port, Write->Register & 0xFF);
+			ym2612_w(0, Port | 0x01, Write->Data);
+		}
+		uint32_t Length = std::min(Pieces[Piece++ % Pieces.size()], CASE_LENGTH - Sample);
+		if(Write != S.Writes.end()){
+			Length = std::min(Length, Write->Sample - Sample);
+		}
+		ym2612_stream_update(0, Buffers, Length);
+		for(uint32_t i = 0; i < Length; i++){
+			Result.Output.push_back(Left[i]);
+			Result.Output.push_back(Right[i]);
+		}
+		Sample += Length;
+	}
+
+	for(uint32_t Chunk = 0; Chunk < CASE_LENGTH; Chunk += CHUNK_LENGTH){
+		uint64_t Value = HASH_INIT;
+		for(uint32_t i = Chunk * 2; i < (Chunk + CHUNK_LENGTH) * 2; i++){
+			Value = Hash(Value, Result.Output[i]);
+			Result.Total = Hash(Result.Total, Result.Output[i]);
+		}
+		Result.Chunks.push_back(Value);
+	}
+	return Result;
+}
+
+static void DumpCase(const fs::path &File, const CaseResult &Result){
+	std::ofstream Out(File, std::ios::binary);
+	Out.write(reinterpret_cast<const char *>(Result.Output.data()), static_cast<std::streamsize>(Result.Output.size() * sizeof(int32_t)));
+}
+
+// golden file: one line per case, "<name> <total hash> <chunk hashes...>", # starts a comment
+static std::map<std::string, std::vector<uint64_t>> LoadGolden(const fs::path &File){
+	std::map<std::string, std::vector<uint64_t>> Golden;
+	std::ifstream In(File);
+	std::string Line;
+	while(std::getline(In, Line)){
+		if(Line.empty() || Line[0] == '#'){
+			continue;
+		}
+		std::istringstream Fields(Line);
+		std::string Name;
+		Fields >> Name;
+		std::string Value;
+		while(Fields >> Value){
+			Golden[Name].push_back(std::stoull(Value, nullptr, 16));
+		}
+	}
+	return Golden;
+}
+
+int main(int argc, char **argv){
+	if(argc < 2){
+		std::fprintf(stderr, "Usage: %s <golden file> [--update] [--dump <dir>]\n", argv[0]);
+		return 1;
+	}
+	fs::path GoldenFile = argv[1];
+	bool Update = false;
+	fs::path DumpDir;
+	for(int i = 2; i < argc; i++){
+		if(!std::strcmp(argv[i], "--update")){
+			Update = true;
+		}else if(!std::strcmp(argv[i], "--dump") && i + 1 < argc){
+			DumpDir = argv[++i];
+		}
+	}
+
+	device_start_ym2612(0, YM2612_CLOCK);
+	auto Golden = LoadGolden(GoldenFile);
+	std::ostringstream NewGolden;
+	NewGolden << "# YM2612 golden output, regenerate with: OPNGolden " << GoldenFile.filename().string() << " --update\n"
+	          << "# case, hash of all samples, hashes of every " << CHUNK_LENGTH << " samples\n";
+
+	// every SIMD path the CPU has has to match, the golden file is written from the scalar one
+	int Failures = 0;
+	const FM_ISA BestISA = ym2612_supported_isa(FM_ISA::AVX512);
+	for(auto ISA = FM_ISA::SCALAR; ISA <= BestISA; ISA = static_cast<FM_ISA>(static_cast<uint8_t>(ISA) + 1)){
+		if(ym2612_select_isa(ISA) != ISA){
+			continue;    // compiled without it
+		}
+		const std::string ISAName = ISANames[static_cast<uint8_t>(ISA)];
+		std::printf("%s:\n", ISAName.c_str());
+		const bool Reference = ISA == FM_ISA::SCALAR;
+
+		for(const auto &Test : Corpus()){
+			CaseResult Result = Render(Test.Build());
+
+			if(Reference){
+				char Hex[17];
+				std::snprintf(Hex, sizeof(Hex), "%016llx", static_cast<unsigned long long>(Result.Total));
+				NewGolden << Test.Name << ' ' << Hex;
+				for(uint64_t Chunk : Result.Chunks){
+					std::snprintf(Hex, sizeof(Hex), "%016llx", static_cast<unsigned long long>(Chunk));
+					NewGolden << ' ' << Hex;
+				}
+				NewGolden << '\n';
+
+				if(!DumpDir.empty()){
+					fs::create_directories(DumpDir);
+					DumpCase(DumpDir / (Test.Name + ".raw"), Result);
+				}
+			}
+			if(Update){
+				continue;
+			}
+
+			auto Expected = Golden.find(Test.Name);
+			if(Expected == Golden.end()){
+				std::printf("\t%-10s MISSING from %s\n", Test.Name.c_str(), GoldenFile.string().c_str());
+				Failures++;
+				continue;
+			}
+			if(!Expected->second.empty() && Expected->second[0] == Result.Total){
+				std::printf("\t%-10s ok\n", Test.Name.c_str());
+				continue;
+			}
+
+			Failures++;
+			std::printf("\t%-10s MISMATCH\n", Test.Name.c_str());
+			for(size_t Chunk = 0; Chunk < Result.Chunks.size(); Chunk++){
+				if(Chunk + 1 < Expected->second.size() && Expected->second[Chunk + 1] == Result.Chunks[Chunk]){
+					continue;
+				}
+				uint32_t Start = static_cast<uint32_t>(Chunk) * CHUNK_LENGTH;
+				std::printf("\t\tsamples %u-%u differ, starting with:", Start, Start + CHUNK_LENGTH - 1);
+				for(uint32_t i = Start; i < Start + 4; i++){
+					std::printf(" (%d, %d)", Result.Output[i * 2], Result.Output[i * 2 + 1]);
+				}
+				std::printf("\n");
+			}
+			fs::path Actual = Test.Name + "." + ISAName + ".actual.raw";
+			DumpCase(Actual, Result);
+			std::printf("\t\toutput written to %s, compare it with the --dump of a known-good build\n", Actual.string().c_str());
+		}
+		if(Update){
+			break;
+		}
+	}
+
+	device_stop_ym2612(0);
+
+	if(Update){
+		std::ofstream(GoldenFile) << NewGolden.str();
+		std::printf("%s updated\n", GoldenFile.string().c_str());
+		return 0;
+	}
+	return Failures ? 1 : 0;
+}
@@ -5,14 +5,12 @@
 #include <fstream>
 #include <iterator>
 #include <array>
-#include <thread>
 #include <iostream>
 
 using DRUM_SOUND = std::vector<uint8_t>;
 
 constexpr uint8_t DRUM_COUNT = 2;
-
-static std::atomic<bool> flag;
+constexpr uint32_t SAMPLE_RATE = 44100;
 
 namespace fs = std::filesystem;
 void LoadDrumSound(const fs::path &FileName, DRUM_SOUND &DrumSnd){
@@ -22,46 +20,78 @@ void LoadDrumSound(const fs::path &FileName, DRUM_SOUND &DrumSnd){
 	DrumSnd.insert(DrumSnd.begin(), std::istream_iterator<uint8_t>(drumStream), std::istream_iterator<uint8_t>());
 }
 
-void Timer(const std::array<DRUM_SOUND, DRUM_COUNT> &DrumLib){
+struct Sequencer {
+	std::array<DRUM_SOUND, DRUM_COUNT> DrumLib;
 	uint8_t NextDrum = 0;
-	uint8_t playCount = 20;
-	while(!flag.load(std::memory_order::relaxed)){
-		PlayDACSample(0, DrumLib[NextDrum++], 0);
-		NextDrum %= 2;
-		std::this_thread::sleep_for(std::chrono::milliseconds(500));
-		if(--playCount == 0) { break; }
+	uint8_t PlayCount = 20;
+};
+
+// Runs every 500 ms of output, in step with the audio
+void Tick(void *User, uint64_t /*Frame*/){
+	auto *Seq = static_cast<Sequencer *>(User);
+	if(Seq->PlayCount == 0){
+		return;
 	}
+	PlayDACSample(0, Seq->DrumLib[Seq->NextDrum++], 0);
+	Seq->NextDrum %= DRUM_COUNT;
+	Seq->PlayCount--;
 }
 
 int main(int argc, char** /*unused*/){
 	if(argc == 0){ // Only here to hide unused warnings for exported functions
 		OpenOPNDriver(MAX_CHIPS);
 		SetOPNOptions();
+		OPN_SetCPUFeatureLevel(OPN_GetCPUFeatureLevel());
 		for(uint8_t i = 0; i < MAX_CHIPS; i++){
 			OPN_Write(i, 0, 0);
+			OPN_ReadStatus(i);
+			OPN_RunCycles(i, 0);
+			OPN_WriteAtCycle(i, 0, 0, 0);
 			OPN_Mute(i, 0);
+			OPN_SetChipMix(i, 0x100, 0);
 			PlayDACSample(i, 0, nullptr, 0);
 			SetDACFrequency(i, 0);
 			SetDACVolume(i, 0);
+			OPN_SaveState(i, nullptr, OPN_GetStateSize());
+			OPN_LoadState(i, nullptr, 0);
 		}
+		OPN_SetTickCallback(nullptr, nullptr, 0);
+		OPN_SetIdleTimeouts(0, 0);
+		OPN_SetQueueLatency(0);
+		OPN_SetKeyframeInterval(0);
+		OPN_Seek(OPN_GetPosition());
+		OPN_GetLength();
+		OPN_STATS Stats;
+		OPN_GetStats(&Stats);
+		OPN_CHIP_STATS ChipStats;
+		OPN_GetChipStats(0, &ChipStats);
+		OPN_ResetStats();
+		OPN_DumpTrace(nullptr);
+		CloseOPNDriver();
+		OPN_SetDeviceOptions(nullptr);
+		OPN_SetRealtimeOptions(nullptr);
+		OPN_REALTIME_STATUS Realtime;
+		OPN_GetRealtimeStatus(&Realtime);
+		OPN_GetDeviceInfo(nullptr);
+		OPN_OpenOffline(1);
+		OPN_Render(nullptr, 0);
 		CloseOPNDriver();
 		return 0;
 	} // Now for the actual test code
-	std::array<DRUM_SOUND, DRUM_COUNT> DrumLib;
+	Sequencer Seq;
 
+	SetOPNOptions(SAMPLE_RATE);
 	auto RetVal = OpenOPNDriver(1);
 	if(RetVal != DriverReturnCode::Success){
 		return static_cast<int>(RetVal);
 	}
 
-	LoadDrumSound("00_BassDrum.raw", DrumLib[0]);
-	LoadDrumSound("01_Snare.raw", DrumLib[1]);
+	LoadDrumSound("00_BassDrum.raw", Seq.DrumLib[0]);
+	LoadDrumSound("01_Snare.raw", Seq.DrumLib[1]);
 
 	OPN_Write(0, 0x2B, 0x80);
-	flag.store(false, std::memory_order::relaxed);
-	std::thread dac(Timer, DrumLib);
+	OPN_SetTickCallback(Tick, &Seq, SAMPLE_RATE / 2);
 	std::cout << "Press Enter to end test\n";
 	std::cin.ignore();
-	flag.store(true, std::memory_order::relaxed);
-	dac.join();
+	OPN_SetTickCallback(nullptr, nullptr, 0);
 }
\ No newline at end of file
@@ -4,11 +4,38 @@
 #include "OPN_DLL.hpp"
 
 #include "audio/stream.hpp"
+#include "src/realtime.hpp"
+#include "src/trace.hpp"
 #include "src/ym2612/fm2612.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string_view>
 #include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#define OPN_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define OPN_TARGET(isa)    // MSVC allows all intrinsics everywhere
+#else
+#define OPN_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define OPN_NEON 1
+#include <arm_neon.h>
+#endif
 
 constexpr uint32_t YM2612_CLOCK = 7670454;
+constexpr uint32_t CYCLES_PER_SAMPLE = 144;    // master clock cycles per chip sample
 
 extern "C" {
 uint32_t SampleRate = 0;    // Note: also used by some sound cores to determinate the chip sample rate
@@ -16,27 +43,375 @@ uint32_t SampleRate = 0;    // Note: also used by some sound cores to determinat
 
 static uint8_t OPN_CHIPS = 0x00;    // also indicates, if DLL is running
 
-std::array<ChipAudioAttributes, MAX_CHIPS> ChipAudio;
-// Todo: Give better name or make not global
-std::array<DACState, MAX_CHIPS> DACStates;
-
 constexpr uint32_t SMPL_BUFSIZE = 0x100;
+constexpr uint32_t PRERENDER_SIZE = 0x1000;    // most output rendered ahead on resume, ~90 ms at 44.1 kHz
 static int32_t *StreamBufs[0x02];
 stream_sample_t *DUMMYBUF[0x02] = {nullptr, nullptr};
 
-static uint32_t NullSamples;
+static uint32_t NullSamples;    // consecutive silent frames, 0xFFFFFFFF = paused
+static uint32_t IdlePauseMs = 1000;
+constexpr int32_t SILENCE_PEAK = 2;    // output level that still counts as silent (~-84 dBFS), decayed tails don't keep it running
+static uint32_t IdleSuspendMs = 5000;
+static bool Offline = false;    // opened by OPN_OpenOffline, the host pulls the output with OPN_Render
+static STREAM_OPTIONS DeviceOptions{};
 
 static std::mutex writeGuard;
 
+// Paused, FillBuffer only outputs silence without rendering anything and the backend stops the device
+// after IdleSuspendMs more. Both are cheap, they're called on every key on.
+static void PauseOutput(){
+	NullSamples = 0xFFFFFFFF;
+	PauseStream(true, IdleSuspendMs);
+}
+
+static void ResumeOutput(){
+	NullSamples = 0;
+	PauseStream(false, 0);
+}
+
+// Performance counters: only changed while holding writeGuard, so a relaxed load/store pair is enough
+// to update them, while OPN_GetStats can read them from any thread without taking the lock.
+class StatCounter {
+public:
+	void Add(uint64_t Value){
+		Counter.store(Counter.load(std::memory_order_relaxed) + Value, std::memory_order_relaxed);
+	}
+	void Max(uint64_t Value){
+		if(Value > Counter.load(std::memory_order_relaxed)){
+			Counter.store(Value, std::memory_order_relaxed);
+		}
+	}
+	void Reset(){
+		Counter.store(0, std::memory_order_relaxed);
+	}
+	[[nodiscard]] uint64_t Get() const{
+		return Counter.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> Counter{0};
+};
+
+struct DriverStats {
+	StatCounter Callbacks, Frames, Writes, Underruns;
+	StatCounter LockContentions, LockWaitNs;
+	StatCounter CallbackNs, CallbackMaxNs, CallbackMaxFrames;
+	std::array<StatCounter, OPN_STATS_HISTOGRAM_BUCKETS> CallbackHistogram;
+	StatCounter ProfiledCallbacks, ProfiledChipNs, ProfiledResampleNs, ProfiledMixNs;
+	StatCounter PausedCallbacks;
+};
+
+constexpr size_t CACHE_LINE = 64;
+
+// Own cache line per chip, chips may run on different threads
+struct alignas(CACHE_LINE) ChipStats {
+	StatCounter Samples, SkippedSamples, Writes;
+	StatCounter QueueMaxSamples, QueueOverruns, QueueUnderruns;
+};
+
+// Everything the driver keeps per chip, the emulated chip included. Slots are padded to whole cache lines,
+// so chips rendered on different threads never share one.
+constexpr size_t CHIP_LIMIT = 0xFF;    // chip IDs are 8 bit
+
+// Samples of a chip run by OPN_RunCycles, rendered ahead on the host's thread until the resampler takes them
+constexpr size_t QUEUE_SIZE = 0x2000;    // ~150 ms at the chip rate, power of 2
+
+struct SampleQueue {
+	std::array<int32_t, QUEUE_SIZE> Left;
+	std::array<int32_t, QUEUE_SIZE> Right;
+	uint64_t Read = 0;     // free running, the position in the arrays is modulo QUEUE_SIZE
+	uint64_t Write = 0;
+
+	// dynamic rate control, see ResampleQueue and AdjustQueueRate
+	bool Primed = false;      // the queue filled up to the latency, false again after running dry
+	uint64_t Phase = 0;       // output position between Prev and Next, 32.32 fixed point
+	int32_t PrevL = 0, PrevR = 0;
+	int32_t NextL = 0, NextR = 0;
+	double Fill = 0.0;        // low passed queue fill in samples
+	double Integral = 0.0;    // PI controller state
+	double Ratio = 1.0;       // correction of the nominal chip/output rate ratio
+};
+
+static uint32_t QueueLatency = 2048;    // fill level the rate control steers the queues to, in chip samples
+
+// Gains a chip is mixed with, taken from MixSettings at the start of each buffer
+struct ChipMix {
+	float Left;
+	float Right;
+	bool Unity;    // added to the bus as it is
+};
+
+constexpr uint16_t MIX_UNITY = 0x100;
+constexpr uint16_t MIX_MAX_GAIN = 0x400;
+constexpr int32_t CHIP_PEAK = 6 * 8192;    // loudest sample of a chip, all six channels at the core's limit
+
+struct alignas(CACHE_LINE) ChipSlot {
+	ChipAudioAttributes Audio;
+	DACState DAC;
+	ChipMix Mix;
+	SampleQueue *Queue;    // only for chips run by OPN_RunCycles, freed by DeinitChips
+	uint32_t Cycles;       // cycles run that don't make up a whole sample yet
+	uint8_t MuteMask;      // OPN_Mute, the chip's state leaves it out
+	alignas(YM2612) std::byte Chip[sizeof(YM2612)];    // constructed by device_start_ym2612
+};
+
+// Resampler and mixer scratch, used by the rendering thread only
+struct alignas(CACHE_LINE) ScratchBuffers {
+	std::array<int32_t, SMPL_BUFSIZE> Left;
+	std::array<int32_t, SMPL_BUFSIZE> Right;
+	std::array<WAVE_32BS, SMPL_BUFSIZE> Bus;     // a run of all chips mixed
+	std::array<WAVE_32BS, SMPL_BUFSIZE> Chip;    // a run of a chip that isn't added to the bus as it is
+	std::array<WAVE_16BS, PRERENDER_SIZE> Prerendered;    // see PrerenderBuffer
+};
+
+// OpenOPNDriver allocates the slots of all chips and the scratch buffers as one block, DeinitChips frees it.
+// The chips are stopped before, the rest needs no destruction.
+static_assert(std::is_trivially_destructible_v<ChipSlot> && std::is_trivially_destructible_v<ScratchBuffers>);
+static std::byte *Arena = nullptr;
+static size_t ArenaSize = 0;
+static ChipSlot *ChipSlots = nullptr;    // OPN_CHIPS entries
+static ScratchBuffers *Scratch = nullptr;
+
+// Output rendered ahead by PrerenderBuffer, FillBuffer hands it out before rendering anything new
+static uint32_t PrerenderPos = 0, PrerenderEnd = 0;
+static bool Prerendering = false;
+
+static void DropPrerendered(){
+	PrerenderPos = PrerenderEnd = 0;
+}
+
+// Gain << 8 | Pan of every chip, set by OPN_SetChipMix and picked up by LoadChipMix. Outside the arena,
+// so setting it needs no lock even while the driver is closed.
+static std::array<std::atomic<uint32_t>, CHIP_LIMIT> MixSettings;
+
+// Counters of every chip, outside the arena as well, OPN_GetChipStats reads them without the lock
+static std::array<ChipStats, CHIP_LIMIT> ChipCounters;
+
+// OPN_SetRealtimeOptions: the thread part is left to the rendering thread, FillBuffer picks it up
+static OPN_REALTIME_OPTIONS RealtimeOptions{};
+static bool RealtimePending = false;
+static std::atomic<uint8_t> RealtimeApplied{0};
+static std::atomic<uint8_t> RealtimeDenied{0};
+
+static void RealtimeResult(uint8_t Bit, bool Granted){
+	if(Granted){
+		RealtimeApplied.fetch_or(Bit, std::memory_order_relaxed);
+		RealtimeDenied.fetch_and(static_cast<uint8_t>(~Bit), std::memory_order_relaxed);
+	}else{
+		RealtimeDenied.fetch_or(Bit, std::memory_order_relaxed);
+	}
+}
+
+static void ApplyThreadOptions(){
+	RealtimePending = false;
+	if(RealtimeOptions.Policy != OPN_SCHED_DEFAULT){
+		RealtimeResult(OPN_RT_SCHEDULING, Realtime::SetScheduling(RealtimeOptions.Policy, RealtimeOptions.Priority));
+	}
+	if(RealtimeOptions.CPUMask){
+		RealtimeResult(OPN_RT_AFFINITY, Realtime::SetAffinity(RealtimeOptions.CPUMask));
+	}
+	Realtime::PrefaultStack();
+}
+
+static bool LockHistoryMemory();
+
+// Everything the rendering thread touches that's allocated per driver: the arena, the OPN_RunCycles queues
+// and the seek history
+static void ApplyMemoryLock(){
+	if(!RealtimeOptions.LockMemory || Arena == nullptr){
+		return;
+	}
+	bool Locked = Realtime::LockMemory(Arena, ArenaSize);
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		if(ChipSlots[CurChip].Queue != nullptr){
+			Locked = Realtime::LockMemory(ChipSlots[CurChip].Queue, sizeof(SampleQueue)) && Locked;
+		}
+	}
+	Locked = LockHistoryMemory() && Locked;
+	RealtimeResult(OPN_RT_MEMLOCK, Locked);
+}
+
+static DriverStats Statistics;
+static bool ProfileCallback = false;    // current callback is split into its parts
+static uint64_t ProfiledChipNs = 0;
+
+static void ResetStats(){
+	auto ResetAll = [](auto &...Counters) { (Counters.Reset(), ...); };
+	ResetAll(Statistics.Callbacks, Statistics.Frames, Statistics.Writes, Statistics.Underruns, Statistics.LockContentions, Statistics.LockWaitNs,
+	         Statistics.CallbackNs, Statistics.CallbackMaxNs, Statistics.CallbackMaxFrames,
+	         Statistics.ProfiledCallbacks, Statistics.ProfiledChipNs, Statistics.ProfiledResampleNs, Statistics.ProfiledMixNs,
+	         Statistics.PausedCallbacks);
+	for(auto &Bucket : Statistics.CallbackHistogram){
+		Bucket.Reset();
+	}
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		ChipStats &Chip = ChipCounters[CurChip];
+		ResetAll(Chip.Samples, Chip.SkippedSamples, Chip.Writes, Chip.QueueMaxSamples, Chip.QueueOverruns, Chip.QueueUnderruns);
+	}
+}
+
+INLINE uint64_t TimeNs(){
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+INLINE uint32_t MulDivRoundU(uint64_t Mul1, uint64_t Mul2, uint64_t Div){
+	return static_cast<uint32_t>((Mul1 * Mul2 + Div / 2) / Div);
+}
+
+// Snapshot of one chip, including the parts of the driver that belong to it
+// Layout version, bump on any change to this struct or YM2612_STATE
+constexpr uint32_t OPN_STATE_MAGIC = 0x534E504F;    // "OPNS"
+constexpr uint16_t OPN_STATE_VERSION = 0x0002;
+
+// DACState without the sample, the host binds it again with OPN_ResumeDACSample. Delta follows from the frequency.
+struct OPN_DAC_STATE {
+	uint32_t DataSize;    // 0 = no sample playing
+	uint32_t SmplPos;
+	uint32_t SmplFric;
+	uint32_t Frequency;
+	uint16_t Volume;
+	uint16_t Reserved;
+};
+
+struct OPN_STATE {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t Reserved;
+	uint32_t Size;
+	uint32_t OutputRate;    // the resampler state only fits the output rate it was saved at
+	YM2612_STATE Chip;
+	ChipAudioAttributes Audio;
+	OPN_DAC_STATE DAC;
+};
+static_assert(std::is_trivially_copyable_v<OPN_STATE>, "OPN_STATE must be POD-serializable");
+
+// Seek history: keyframes of all chips taken every KeyframeInterval seconds while playing,
+// plus a journal of everything the host did in between, stamped with the output frame it happened at.
+// A seek restores the nearest keyframe and replays the journal up to the target, playing on from there replays
+// the rest of it until the host does something new.
+// Both are rings allocated when the history starts over, so that the rendering thread never allocates:
+// once one is full, the oldest keyframe goes, and the journal up to the next keyframe with it.
+constexpr size_t HISTORY_KEYFRAMES = 64;
+constexpr size_t HISTORY_EVENTS = 0x8000;
+
+enum class HistoryEventType : uint8_t {
+	Write,
+	DACPlay,
+	DACFrequency,
+	DACVolume,
+	Mute,
+};
+
+struct HistoryEvent {
+	uint64_t Frame;
+	HistoryEventType Type;
+	uint8_t ChipID;
+	uint16_t Register;    // Write: register, DACVolume: volume
+	uint32_t Value;       // Write: data (+ 0x100 if the chip was paused), DACPlay/DACFrequency: frequency, Mute: mask
+	std::span<uint8_t const> Sample;    // DACPlay, one of HistorySamples
+	bool Tick;            // written by the tick callback
+};
+
+struct Keyframe {
+	uint64_t Frame;
+	uint64_t Event;    // first journal entry after it
+	uint32_t NullSamples;
+};
+
+struct KeyframeChip {
+	OPN_STATE State;
+	const uint8_t *DACData;    // the snapshot leaves the sample out, one of HistorySamples
+	uint8_t MuteMask;
+};
+
+static uint32_t KeyframeInterval = 0;    // in seconds, 0 = no history
+static std::vector<Keyframe> Keyframes;            // HISTORY_KEYFRAMES entries while enabled
+static std::vector<KeyframeChip> KeyframeChips;    // OPN_CHIPS entries per keyframe
+static std::vector<HistoryEvent> History;          // HISTORY_EVENTS entries while enabled
+static uint64_t KeyFirst = 0, KeyEnd = 0;          // free running positions in the rings
+static uint64_t EventFirst = 0, EventEnd = 0;
+static uint64_t ReplayNext = 0;    // journal entry playback applies next after a seek back, EventEnd otherwise
+static thread_local bool InTick = false;    // see HistoryEvent::Tick
+// Copies of the DAC samples played while the history is on, so that it doesn't depend on the host's memory
+static std::vector<std::vector<uint8_t>> HistorySamples;
+static size_t SamplePruneAt = 16;
+static uint64_t StreamCursor = 0;    // output frames rendered since OpenOPNDriver
+static uint64_t HistoryEnd = 0;      // last frame covered by the history (can be past the cursor after a seek)
+
+// Sequencer tick (OPN_SetTickCallback)
+static OPN_TICK_CALLBACK TickCallback = nullptr;
+static void *TickUser = nullptr;
+static uint32_t TickPeriod = 0;    // in output frames, 0 = on Timer B of chip 0
+static uint64_t TickOrigin = 0;    // frame of the first periodic tick
+static uint64_t NextTick = 0;
+static uint32_t TickTimerB = 0;    // Timer B overflows of chip 0 already ticked for
+
+// Lines the tick up with the cursor after it jumped (open, seek) or the tick settings changed
+static void ScheduleTick(){
+	if(TickPeriod){
+		uint64_t Since = StreamCursor > TickOrigin ? StreamCursor - TickOrigin : 0;
+		NextTick = TickOrigin + (Since + TickPeriod - 1) / TickPeriod * TickPeriod;
+	}else if(OPN_CHIPS){
+		TickTimerB = ym2612_timer_b_ticks(0);
+	}
+}
+
+static bool TickDue(){
+	if(TickPeriod){
+		if(StreamCursor < NextTick){
+			return false;
+		}
+		NextTick += TickPeriod;
+		return true;
+	}
+	if(!OPN_CHIPS){
+		return false;
+	}
+	uint32_t Overflows = ym2612_timer_b_ticks(0);
+	if(Overflows == TickTimerB){
+		return false;
+	}
+	TickTimerB = Overflows;
+	return true;
+}
+
+static bool AllocArena(uint8_t ChipCount){
+	const size_t ScratchOffset = sizeof(ChipSlot) * ChipCount;
+	ArenaSize = ScratchOffset + sizeof(ScratchBuffers);
+	Arena = static_cast<std::byte *>(::operator new(ArenaSize, std::align_val_t{CACHE_LINE}, std::nothrow));
+	if(Arena == nullptr){
+		return false;
+	}
+
+	// zeroed slots, the chips that are opened get set up by InitChips
+	ChipSlots = reinterpret_cast<ChipSlot *>(Arena);
+	std::uninitialized_value_construct_n(ChipSlots, ChipCount);
+	Scratch = new(Arena + ScratchOffset) ScratchBuffers;
+	StreamBufs[0x00] = Scratch->Left.data();
+	StreamBufs[0x01] = Scratch->Right.data();
+	return true;
+}
+
 static void DeinitChips(){
 	uint8_t CurChip;
 
-	delete StreamBufs[0x00];
-	delete StreamBufs[0x01];
-
 	for(CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
 		device_stop_ym2612(CurChip);
+		if(ChipSlots[CurChip].Queue != nullptr){
+			Realtime::UnlockMemory(ChipSlots[CurChip].Queue, sizeof(SampleQueue));
+			delete ChipSlots[CurChip].Queue;
+		}
+	}
+
+	if(Arena != nullptr){
+		Realtime::UnlockMemory(Arena, ArenaSize);
 	}
+	::operator delete(Arena, std::align_val_t{CACHE_LINE});
+	Arena = nullptr;    // the unload handler runs this again after CloseOPNDriver
+	ChipSlots = nullptr;
+	Scratch = nullptr;
+	StreamBufs[0x00] = StreamBufs[0x01] = nullptr;
 
 	OPN_CHIPS = 0x00;
 }
@@ -69,31 +444,72 @@ void SetOPNOptions(uint32_t SmplRate){
 	SampleRate = SmplRate;
 }
 
+// Takes BufSize samples of a chip run by OPN_RunCycles out of its queue (Buffer nullptr drops them).
+// When the host is behind, the last sample is held for the missing ones.
+static void PopChipQueue(uint8_t ChipID, int32_t **Buffer, size_t BufSize){
+	ChipSlot &Slot = ChipSlots[ChipID];
+	SampleQueue *Queue = Slot.Queue;
+	size_t Available = std::min<size_t>(BufSize, Queue->Write - Queue->Read);
+	if(Buffer != nullptr){
+		for(size_t CurSmpl = 0; CurSmpl < Available; CurSmpl++){
+			size_t Pos = (Queue->Read + CurSmpl) % QUEUE_SIZE;
+			Buffer[0x00][CurSmpl] = Queue->Left[Pos];
+			Buffer[0x01][CurSmpl] = Queue->Right[Pos];
+		}
+		size_t Last = (Queue->Read + Available + QUEUE_SIZE - 1) % QUEUE_SIZE;
+		for(size_t CurSmpl = Available; CurSmpl < BufSize; CurSmpl++){
+			Buffer[0x00][CurSmpl] = Queue->Left[Last];
+			Buffer[0x01][CurSmpl] = Queue->Right[Last];
+		}
+	}
+	Queue->Read += Available;
+	if(Available < BufSize){
+		ChipCounters[ChipID].QueueUnderruns.Add(BufSize - Available);
+	}
+}
+
 INLINE void GetChipStream(uint8_t ChipID, int32_t **Buffer, size_t BufSize){
+	OPN_TRACE_SCOPE("Chip update", ChipID);
+	if(ChipSlots[ChipID].Queue != nullptr){
+		PopChipQueue(ChipID, Buffer, BufSize);    // rendered by OPN_RunCycles already
+		return;
+	}
+	ChipCounters[ChipID].Samples.Add(BufSize);
+	if(ProfileCallback){
+		uint64_t Start = TimeNs();
+		ym2612_stream_update(ChipID, Buffer, BufSize);
+		ProfiledChipNs += TimeNs() - Start;
+		return;
+	}
 	ym2612_stream_update(ChipID, Buffer, BufSize);
 }
 
+INLINE void AdvanceChipStream(uint8_t ChipID, size_t Samples){
+	OPN_TRACE_SCOPE("Chip skip", ChipID);
+	if(ChipSlots[ChipID].Queue != nullptr){
+		PopChipQueue(ChipID, nullptr, Samples);
+		return;
+	}
+	ChipCounters[ChipID].SkippedSamples.Add(Samples);
+	ym2612_stream_skip(ChipID, Samples);
+}
+
+static void ResetHistory();
+
 static void InitChips(uint8_t ChipCount){
 	uint8_t CurChip;
 	ChipAudioAttributes *CAA;
 
-	for(CurChip = 0x00; CurChip < MAX_CHIPS; CurChip++){
-		CAA = &ChipAudio[CurChip];
-		CAA->SmpRate = 0x00;
-		CAA->Volume = 0x00;
-
-		DACStates[CurChip].Data = nullptr;
-	}
-
 	for(CurChip = 0x00; CurChip < ChipCount; CurChip++){
-		CAA = &ChipAudio[CurChip];
-		CAA->SmpRate = device_start_ym2612(CurChip, YM2612_CLOCK);
+		CAA = &ChipSlots[CurChip].Audio;
+		CAA->SmpRate = device_start_ym2612(CurChip, YM2612_CLOCK, ChipSlots[CurChip].Chip);
 		CAA->Volume = 0x100;
+		MixSettings[CurChip].store(MIX_UNITY << 8, std::memory_order_relaxed);
 		device_reset_ym2612(CurChip);
 	}
 
 	for(CurChip = 0x00; CurChip < ChipCount; CurChip++){
-		CAA = &ChipAudio[CurChip];
+		CAA = &ChipSlots[CurChip].Audio;
 		if(!CAA->SmpRate){
 			CAA->Resampler = 0xFF;
 		}else if(CAA->SmpRate < SampleRate){
@@ -119,247 +535,1756 @@ static void InitChips(uint8_t ChipCount){
 			CAA->NSmpl.Right = 0x00;
 		}
 
-		DACStates[CurChip].Data = nullptr;
-		DACStates[CurChip].Volume = 0x100;
-		DACStates[CurChip].Frequency = 16000;
+		ChipSlots[CurChip].DAC.Data = nullptr;
+		ChipSlots[CurChip].DAC.Volume = 0x100;
+		ChipSlots[CurChip].DAC.Frequency = 16000;
 	}
 
-	StreamBufs[0x00] = new int32_t[SMPL_BUFSIZE];
-	StreamBufs[0x01] = new int32_t[SMPL_BUFSIZE];
-
 	OPN_CHIPS = ChipCount;
+	ResetStats();
+
+	StreamCursor = 0;
+	DropPrerendered();
+	ResetHistory();
+	TickOrigin = 0;
+	ScheduleTick();
 }
 
-DriverReturnCode OpenOPNDriver(uint8_t Chips){
+// CPU feature level
+static_assert(static_cast<uint8_t>(CPUFeatureLevel::Scalar) == static_cast<uint8_t>(FM_ISA::SCALAR)
+              && static_cast<uint8_t>(CPUFeatureLevel::AVX512) == static_cast<uint8_t>(FM_ISA::AVX512),
+              "CPUFeatureLevel has to match FM_ISA");
+
+static CPUFeatureLevel RequestedCPULevel = CPUFeatureLevel::Auto;
+
+static void SelectMixKernels(CPUFeatureLevel Level, FM_ISA Isa);
+
+static void SelectCPUFeatureLevel(){
+	CPUFeatureLevel Level = RequestedCPULevel;
+	if(Level == CPUFeatureLevel::Auto){
+		if(const char *Env = std::getenv("OPN_CPU")){
+			constexpr std::array<std::pair<std::string_view, CPUFeatureLevel>, 4> Names = {{
+					{"scalar", CPUFeatureLevel::Scalar},
+					{"sse4.1", CPUFeatureLevel::SSE41},
+					{"avx2", CPUFeatureLevel::AVX2},
+					{"avx512", CPUFeatureLevel::AVX512},
+			}};
+			auto Name = std::ranges::find(Names, std::string_view(Env), &std::pair<std::string_view, CPUFeatureLevel>::first);
+			if(Name != Names.end()){
+				Level = Name->second;
+			}
+		}
+	}
+	// all paths render the same samples, so Auto simply takes the widest one the CPU supports
+	FM_ISA Isa = ym2612_select_isa(Level == CPUFeatureLevel::Auto ? FM_ISA::AVX512 : static_cast<FM_ISA>(Level));
+	SelectMixKernels(Level, Isa);
+}
+
+static DriverReturnCode OpenDriver(uint8_t Chips, bool WithDevice){
 	using enum DriverReturnCode;
 	if(OPN_CHIPS){
 		return DriverAlreadyInitalized;
 	}    // already running
-	if(Chips > 0x10){
-		return TooManyChips;    // too many chips
+	if(!AllocArena(Chips)){
+		return TooManyChips;    // not enough memory for that many chips
 	}
 
-	InitChips(Chips);
-	if(StartStream(0x00)){
+	if(SampleRate == OPN_CHIP_RATE || (!WithDevice && !SampleRate)){
+		SampleRate = YM2612_CLOCK / CYCLES_PER_SAMPLE;
+	}
+	// the stream is opened first, as it resolves SampleRate 0 to the device's native rate
+	if(WithDevice && StartStream(0x00, DeviceOptions)){
 		//printf("Error opening Sound Device!\n");
 		CloseOPNDriver();
 
 		return SoundDeviceError;
 	}
+	Offline = !WithDevice;
 
-	NullSamples = 0xFFFFFFFF;
-	PauseStream(true);
+	const std::lock_guard lock(writeGuard);
+	SelectCPUFeatureLevel();
+	InitChips(Chips);
+	ApplyMemoryLock();
+	RealtimePending = true;
+	if(Offline){
+		ResumeOutput();
+	}else{
+		PauseOutput();    // until the first key on
+	}
 
 	return Success;
 }
 
-void CloseOPNDriver(){
-	StopStream(false);
+DriverReturnCode OpenOPNDriver(uint8_t Chips){
+	return OpenDriver(Chips, true);
+}
 
-	DeinitChips();
+DriverReturnCode OPN_OpenOffline(uint8_t Chips){
+	return OpenDriver(Chips, false);
 }
 
-void OPN_Write(uint8_t ChipID, uint16_t Register, uint8_t Data){
-	if(ChipID >= OPN_CHIPS){
-		return;
+void OPN_Render(int16_t *Buffer, uint32_t Frames){
+	static_assert(sizeof(WAVE_16BS) == 2 * sizeof(int16_t));
+	if(!Offline){
+		return;    // the sound device pulls the output itself
 	}
+	FillBuffer(reinterpret_cast<WAVE_16BS *>(Buffer), Frames);
+}
 
-	const std::lock_guard lock(writeGuard);
-	if(Register == 0x28 && static_cast<bool>(Data & 0xF0)){
-		// Note On - Resume Stream
-		NullSamples = 0;
-		PauseStream(false);
+void CloseOPNDriver(){
+	if(!Offline){
+		StopStream(false);
 	}
+	Offline = false;
 
-	if(NullSamples == 0xFFFFFFFF){    // if chip is paused, do safe update
-		GetChipStream(ChipID, StreamBufs, 1);
-	}
+	DeinitChips();
 
-	uint8_t RegSet = Register >> 8;
-	ym2612_w(ChipID, 0x00 | (RegSet << 1), Register & 0xFF);
-	ym2612_w(ChipID, 0x01 | (RegSet << 1), Data);
+	// not part of DeinitChips, on unload the history may already be destroyed
+	ResetHistory();
 }
 
-void OPN_Mute(uint8_t ChipID, uint8_t MuteMask){
-	if(ChipID >= OPN_CHIPS){
-		return;
-	}
+// Seek history
+static void SaveChipState(uint8_t ChipID, OPN_STATE &State){
+	std::memset(&State, 0x00, sizeof(OPN_STATE));    // keep padding deterministic
+	State.Magic = OPN_STATE_MAGIC;
+	State.Version = OPN_STATE_VERSION;
+	State.Size = sizeof(OPN_STATE);
 
-	const std::lock_guard lock(writeGuard);
-	ym2612_set_mute_mask(ChipID, MuteMask);
+	State.OutputRate = SampleRate;
+
+	ym2612_save_state(ChipID, State.Chip);
+	State.Audio = ChipSlots[ChipID].Audio;
+	const DACState &DAC = ChipSlots[ChipID].DAC;
+	State.DAC = {DAC.Data != nullptr ? DAC.DataSize : 0, DAC.SmplPos, DAC.SmplFric, DAC.Frequency, DAC.Volume, 0};
 }
 
-INLINE int16_t Limit2Short(int32_t Value){
-	if(Value < -0x8000){
-		Value = -0x8000;
-	} else if(Value > 0x7FFF){
-		Value = 0x7FFF;
+// Counterpart of SaveChipState, leaves everything as it is if the chip rejects the snapshot.
+// A sample that was playing stays unbound.
+static bool RestoreChipState(uint8_t ChipID, const OPN_STATE &State){
+	if(!ym2612_load_state(ChipID, State.Chip)){
+		return false;
 	}
+	ChipSlots[ChipID].Audio = State.Audio;
+	DACState &DAC = ChipSlots[ChipID].DAC;
+	DAC.Data = nullptr;
+	DAC.DataSize = State.DAC.DataSize;
+	DAC.SmplPos = State.DAC.SmplPos;
+	DAC.SmplFric = State.DAC.SmplFric;
+	DAC.Frequency = State.DAC.Frequency;
+	DAC.Volume = State.DAC.Volume;
+	DAC.Delta = MulDivRoundU(0x10000, DAC.Frequency, SampleRate);
+	return true;
+}
 
-	return static_cast<int16_t>(Value);
+static Keyframe &KeyAt(uint64_t Pos){
+	return Keyframes[Pos % HISTORY_KEYFRAMES];
 }
 
-// I recommend 11 bits as it's fast and accurate
-const uint32_t FIXPNT_BITS = 11;
-const uint32_t FIXPNT_FACT = 1 << FIXPNT_BITS;
-#if (FIXPNT_BITS <= 11)
-using SLINT = uint32_t;    // 32-bit is a lot faster
-#else
-typedef uint64_t	SLINT;
-#endif
-const uint32_t FIXPNT_MASK = FIXPNT_FACT - 1;
+static KeyframeChip *KeyChips(uint64_t Pos){
+	return &KeyframeChips[Pos % HISTORY_KEYFRAMES * OPN_CHIPS];
+}
 
-INLINE uint32_t getfriction(uint32_t x){
-	return x & FIXPNT_MASK;
+static HistoryEvent &EventAt(uint64_t Pos){
+	return History[Pos % HISTORY_EVENTS];
 }
 
-INLINE uint32_t getnfriction(uint32_t x){
-	return (FIXPNT_FACT - x) & FIXPNT_MASK;
+// Playing back what was recorded after a seek back
+static bool Replaying(){
+	return ReplayNext != EventEnd || StreamCursor < HistoryEnd;
 }
 
-INLINE uint32_t fpi_floor(uint32_t x){
-	return (x) & ~FIXPNT_MASK;
+static void DropOldestKeyframe(){
+	KeyFirst++;
+	EventFirst = KeyAt(KeyFirst).Event;
 }
 
-INLINE uint32_t fpi_ceil(uint32_t x){
-	return (x + FIXPNT_MASK) & ~FIXPNT_MASK;
+static void CaptureKeyframe(){
+	if(KeyEnd - KeyFirst == HISTORY_KEYFRAMES){
+		DropOldestKeyframe();
+	}
+	Keyframe &Key = KeyAt(KeyEnd);
+	Key.Frame = StreamCursor;
+	Key.Event = EventEnd;
+	Key.NullSamples = NullSamples;
+	KeyframeChip *Chips = KeyChips(KeyEnd);
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		SaveChipState(CurChip, Chips[CurChip].State);
+		Chips[CurChip].DACData = ChipSlots[CurChip].DAC.Data;
+		Chips[CurChip].MuteMask = ChipSlots[CurChip].MuteMask;
+	}
+	KeyEnd++;
 }
 
-INLINE uint32_t fp2i_floor(uint32_t x){
-	return (x) / FIXPNT_FACT;
+// Frees the sample copies nothing refers to anymore
+static void PruneSamples(){
+	std::erase_if(HistorySamples, [](const std::vector<uint8_t> &Sample) {
+		const uint8_t *Data = Sample.data();
+		for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+			if(ChipSlots[CurChip].DAC.Data == Data){
+				return false;
+			}
+		}
+		for(uint64_t Pos = KeyFirst; Pos < KeyEnd; Pos++){
+			const KeyframeChip *Chips = KeyChips(Pos);
+			for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+				if(Chips[CurChip].DACData == Data){
+					return false;
+				}
+			}
+		}
+		for(uint64_t Pos = EventFirst; Pos < EventEnd; Pos++){
+			if(EventAt(Pos).Type == HistoryEventType::DACPlay && EventAt(Pos).Sample.data() == Data){
+				return false;
+			}
+		}
+		return true;
+	});
 }
 
-INLINE uint32_t fp2i_ceil(uint32_t x){
-	return (x + FIXPNT_MASK) / FIXPNT_FACT;
+// The history's own copy of a sample, the host may free its buffer as soon as PlayDACSample returns
+static std::span<uint8_t const> InternSample(std::span<uint8_t const> Data){
+	if(Data.empty()){
+		return Data;
+	}
+	for(const auto &Sample : HistorySamples){
+		if(Sample.size() == Data.size() && (Sample.data() == Data.data() || std::ranges::equal(Sample, Data))){
+			return Sample;
+		}
+	}
+	if(HistorySamples.size() >= SamplePruneAt){
+		PruneSamples();
+		SamplePruneAt = std::max<size_t>(16, HistorySamples.size() * 2);
+	}
+	return HistorySamples.emplace_back(Data.begin(), Data.end());
 }
 
-static void UpdateDAC(uint8_t ChipID, uint32_t Samples){
-	DACState *TempDAC = &DACStates[ChipID];
-	if(TempDAC->Data == nullptr){
+static bool LockHistoryMemory(){
+	if(History.empty()){
+		return true;
+	}
+	bool Locked = Realtime::LockMemory(Keyframes.data(), Keyframes.size() * sizeof(Keyframe));
+	Locked = Realtime::LockMemory(KeyframeChips.data(), KeyframeChips.size() * sizeof(KeyframeChip)) && Locked;
+	return Realtime::LockMemory(History.data(), History.size() * sizeof(HistoryEvent)) && Locked;
+}
+
+static void UnlockHistoryMemory(){
+	if(History.empty()){
 		return;
 	}
+	Realtime::UnlockMemory(Keyframes.data(), Keyframes.size() * sizeof(Keyframe));
+	Realtime::UnlockMemory(KeyframeChips.data(), KeyframeChips.size() * sizeof(KeyframeChip));
+	Realtime::UnlockMemory(History.data(), History.size() * sizeof(HistoryEvent));
+}
 
-	//RemDelta = TempDAC->Delta * Samples;
-	TempDAC->SmplFric += TempDAC->Delta * Samples;
-	if(TempDAC->SmplFric & 0xFFFF0000){
-		TempDAC->SmplPos += (TempDAC->SmplFric >> 16);
-		TempDAC->SmplFric &= 0x0000FFFF;
-		if(TempDAC->SmplPos >= TempDAC->DataSize){
-			TempDAC->Data = nullptr;
-			ym2612_w(ChipID, 0x00, 0x2A);
-			ym2612_w(ChipID, 0x01, 0x80);
-			return;
+// Starts the history over at the current position with a single keyframe, or frees it when it's off.
+// Allocates, so only ever called from the host's side.
+static void ResetHistory(){
+	UnlockHistoryMemory();
+	KeyFirst = KeyEnd = 0;
+	EventFirst = EventEnd = 0;
+	ReplayNext = 0;
+	HistoryEnd = StreamCursor;
+	if(!KeyframeInterval || !OPN_CHIPS){
+		std::vector<Keyframe>().swap(Keyframes);
+		std::vector<KeyframeChip>().swap(KeyframeChips);
+		std::vector<HistoryEvent>().swap(History);
+		PruneSamples();
+		return;
+	}
+
+	Keyframes.resize(HISTORY_KEYFRAMES);
+	KeyframeChips.resize(HISTORY_KEYFRAMES * OPN_CHIPS);
+	History.resize(HISTORY_EVENTS);
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		DACState &DAC = ChipSlots[CurChip].DAC;
+		if(DAC.Data != nullptr){
+			DAC.Data = InternSample({DAC.Data, DAC.DataSize}).data();
 		}
+	}
+	PruneSamples();
+	if(RealtimeOptions.LockMemory && !LockHistoryMemory()){
+		RealtimeResult(OPN_RT_MEMLOCK, false);
+	}
+	CaptureKeyframe();
+}
 
-		ym2612_w(ChipID, 0x00, 0x2A);
-		if(TempDAC->Volume == 0x100){
-			ym2612_w(ChipID, 0x01, TempDAC->Data[TempDAC->SmplPos]);
-		}else{
-			int32_t SmplData = TempDAC->Data[TempDAC->SmplPos] - 0x80;    // 00..80..FF -> -80..00..+7F
-			SmplData *= TempDAC->Volume;
-			SmplData = (SmplData + 0x80) >> 8;    // +0x80 for proper rounding
-			if(SmplData < -0x80){
-				SmplData = -0x80;
-			}else if(SmplData > 0x7F){
-				SmplData = 0x7F;
-			}
-			ym2612_w(ChipID, 0x01, (uint8_t) (SmplData + 0x80));    // YM2612 takes 00..FF
+// Drops everything recorded after the cursor. Called as soon as the host does something after a seek,
+// from then on the old future no longer applies.
+static void TrimHistory(){
+	if(!Replaying()){
+		return;
+	}
+
+	EventEnd = ReplayNext;
+	while(KeyEnd - KeyFirst > 1 && (KeyAt(KeyEnd - 1).Frame > StreamCursor || KeyAt(KeyEnd - 1).Event > EventEnd)){
+		KeyEnd--;
+	}
+	HistoryEnd = StreamCursor;
+}
+
+static void RecordEvent(HistoryEvent Event){
+	if(!KeyframeInterval){
+		return;
+	}
+
+	TrimHistory();
+	if(EventEnd - EventFirst == HISTORY_EVENTS){
+		// journal full: a keyframe right here, so that the oldest part of it can go
+		CaptureKeyframe();
+		while(EventEnd - EventFirst == HISTORY_EVENTS){
+			DropOldestKeyframe();
 		}
-		NullSamples = 0;    // keep everything running while the DAC is playing
 	}
+	Event.Tick = InTick;
+	EventAt(EventEnd++) = Event;
+	ReplayNext = EventEnd;
 }
 
-void FillBuffer(WAVE_16BS *Buffer, uint32_t BufferSize){
-	uint8_t CurChip;
+static void WriteChip(uint8_t ChipID, uint16_t Register, uint8_t Data, bool SafeUpdate){
+	if(SafeUpdate && ChipSlots[ChipID].Queue == nullptr){    // if chip is paused, do safe update
+		GetChipStream(ChipID, StreamBufs, 1);
+	}
 
-	if(Buffer == nullptr){
+	uint8_t RegSet = Register >> 8;
+	ym2612_w(ChipID, 0x00 | (RegSet << 1), Register & 0xFF);
+	ym2612_w(ChipID, 0x01 | (RegSet << 1), Data);
+	ChipCounters[ChipID].Writes.Add(1);
+	Statistics.Writes.Add(1);
+}
+
+void OPN_Write(uint8_t ChipID, uint16_t Register, uint8_t Data){
+	if(ChipID >= OPN_CHIPS){
 		return;
 	}
 
+	OPN_TRACE_SCOPE("Register write", Register);
 	const std::lock_guard lock(writeGuard);
-	//EnterCriticalSection(&write_sect);
-	for(uint32_t CurSmpl = 0x00; CurSmpl < BufferSize; CurSmpl++){
-		WAVE_32BS TempBuf{};
+	if((Register == 0x28 && static_cast<bool>(Data & 0xF0)) || (Register == 0x27 && static_cast<bool>(Data & 0x03))
+	   || (Register == 0x2B && static_cast<bool>(Data & 0x80))){
+		// Note On, Timer start or DAC enable - Resume Stream
+		ResumeOutput();
+	}
 
-		for(CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
-			UpdateDAC(CurChip, 1);
-		}
-		//for(CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
-		//	ResampleChipStream(CurChip, &TempBuf, 1);
-		//}
+	bool SafeUpdate = NullSamples == 0xFFFFFFFF;
+	RecordEvent({StreamCursor, HistoryEventType::Write, ChipID, Register, Data | (SafeUpdate ? 0x100u : 0x00u), {}, false});
+	WriteChip(ChipID, Register, Data, SafeUpdate);
+}
 
-		TempBuf.Left >>= 7;
-		TempBuf.Right >>= 7;
-		if(!TempBuf.Left && !TempBuf.Right){
-			NullSamples++;
+// Renders the samples the cycles complete into the chip's queue, dropping the oldest ones if it overflows
+static void RunChipCycles(uint8_t ChipID, uint32_t Cycles){
+	ChipSlot &Slot = ChipSlots[ChipID];
+	if(Slot.Queue == nullptr){
+		Slot.Queue = new SampleQueue{};    // zeroed, an empty queue repeats its last sample
+		if(RealtimeOptions.LockMemory){
+			RealtimeResult(OPN_RT_MEMLOCK, Realtime::LockMemory(Slot.Queue, sizeof(SampleQueue)));
 		}
-		Buffer[CurSmpl].Left = Limit2Short(TempBuf.Left);
-		Buffer[CurSmpl].Right = Limit2Short(TempBuf.Right);
 	}
+	SampleQueue *Queue = Slot.Queue;
 
-	if(NullSamples >= SampleRate){
-		NullSamples = 0xFFFFFFFF;
-		PauseStream(true);    // stop the stream if chip isn't used
+	uint64_t Total = static_cast<uint64_t>(Slot.Cycles) + Cycles;
+	uint64_t Samples = Total / CYCLES_PER_SAMPLE;
+	Slot.Cycles = static_cast<uint32_t>(Total % CYCLES_PER_SAMPLE);
+	if(!Samples){
+		return;
 	}
-	//LeaveCriticalSection(&write_sect);
-}
 
-INLINE uint32_t MulDivRoundU(uint64_t Mul1, uint64_t Mul2, uint64_t Div){
-	return static_cast<uint32_t>((Mul1 * Mul2 + Div / 2) / Div);
+	OPN_TRACE_SCOPE("Chip run", ChipID);
+	ChipCounters[ChipID].Samples.Add(Samples);
+	for(uint64_t Remaining = Samples; Remaining;){
+		size_t Pos = Queue->Write % QUEUE_SIZE;
+		size_t Count = std::min<uint64_t>(Remaining, QUEUE_SIZE - Pos);
+		int32_t *Buffers[0x02] = {&Queue->Left[Pos], &Queue->Right[Pos]};
+		ym2612_stream_update(ChipID, Buffers, Count);
+		Queue->Write += Count;
+		Remaining -= Count;
+	}
+	if(Queue->Write - Queue->Read > QUEUE_SIZE){
+		ChipCounters[ChipID].QueueOverruns.Add(Queue->Write - Queue->Read - QUEUE_SIZE);
+		Queue->Read = Queue->Write - QUEUE_SIZE;
+	}
+	ChipCounters[ChipID].QueueMaxSamples.Max(Queue->Write - Queue->Read);
+	ResumeOutput();    // the host keeps the chip running
 }
 
-void PlayDACSample(uint8_t ChipID, size_t DataSize, const uint8_t *Data, uint32_t SmplFreq){
-	PlayDACSample(ChipID, {Data, DataSize}, SmplFreq);
+void OPN_SetQueueLatency(uint32_t Samples){
+	const std::lock_guard lock(writeGuard);
+	QueueLatency = std::clamp<uint32_t>(Samples, 1, QUEUE_SIZE / 2);
 }
 
-void PlayDACSample(uint8_t ChipID, std::span<uint8_t const> Data, uint32_t SmplFreq){
-	DACState *TempDAC;
-
+void OPN_RunCycles(uint8_t ChipID, uint32_t Cycles){
 	if(ChipID >= OPN_CHIPS){
 		return;
 	}
 
 	const std::lock_guard lock(writeGuard);
-	//EnterCriticalSection(&write_sect);
+	RunChipCycles(ChipID, Cycles);
+}
 
-	TempDAC = &DACStates[ChipID];
-	TempDAC->DataSize = Data.size();
-	TempDAC->Data = Data.data();
-	if(SmplFreq){
-		TempDAC->Frequency = SmplFreq;
+void OPN_WriteAtCycle(uint8_t ChipID, uint32_t Cycles, uint16_t Register, uint8_t Data){
+	if(ChipID >= OPN_CHIPS){
+		return;
 	}
-	TempDAC->Delta = MulDivRoundU(0x10000, TempDAC->Frequency, SampleRate);
-	TempDAC->SmplPos = 0x00;
 
-	// Resume Stream
-	NullSamples = 0;
-	PauseStream(false);
-	//LeaveCriticalSection(&write_sect);
+	OPN_TRACE_SCOPE("Register write", Register);
+	const std::lock_guard lock(writeGuard);
+	RunChipCycles(ChipID, Cycles);
+	WriteChip(ChipID, Register, Data, false);
 }
 
-void SetDACFrequency(uint8_t ChipID, uint32_t SmplFreq){
-	DACState *TempDAC;
+static void SetChipMute(uint8_t ChipID, uint8_t MuteMask){
+	ChipSlots[ChipID].MuteMask = MuteMask;
+	ym2612_set_mute_mask(ChipID, MuteMask);
+}
 
+uint8_t OPN_ReadStatus(uint8_t ChipID){
 	if(ChipID >= OPN_CHIPS){
-		return;
+		return 0x00;
 	}
 
-	TempDAC = &DACStates[ChipID];
-	TempDAC->Frequency = SmplFreq;
-	TempDAC->Delta = MulDivRoundU(0x10000, TempDAC->Frequency, SampleRate);
+	const std::lock_guard lock(writeGuard);
+	return ym2612_r(ChipID, 0x00);
 }
 
-void SetDACVolume(uint8_t ChipID, uint16_t Volume){
-	DACState *TempDAC;
-
+void OPN_Mute(uint8_t ChipID, uint8_t MuteMask){
 	if(ChipID >= OPN_CHIPS){
 		return;
 	}
 
-	TempDAC = &DACStates[ChipID];
-	TempDAC->Volume = Volume;
+	const std::lock_guard lock(writeGuard);
+	RecordEvent({StreamCursor, HistoryEventType::Mute, ChipID, 0x00, MuteMask, {}, false});
+	SetChipMute(ChipID, MuteMask);
 }
 
-size_t GetMaxChipsSupported(){
-	return MAX_CHIPS;
-}
\ No newline at end of file
+INLINE int16_t Limit2Short(int32_t Value){
+	if(Value < -0x8000){
+		Value = -0x8000;
+	} else if(Value > 0x7FFF){
+		Value = 0x7FFF;
+	}
+
+	return static_cast<int16_t>(Value);
+}
+
+// Mixing kernels, one per code path, all of them give the same samples. SelectCPUFeatureLevel picks them along
+// with the chip core's. The resamplers stay scalar, their interpolation divides 64 bit products.
+//
+// ClipRun scales a mixed run down to 16 bit with saturation, true if any sample is louder than SILENCE_PEAK.
+// Activity is collected for the whole run instead of testing each sample.
+// MixRun adds a chip's run to the bus at its gains, saturating. The product is rounded in float, the bus stays fixed point.
+// ClipPlanar is ClipRun for a lone chip's own L/R buffers at its volume, the bus left out (see ClipDirect).
+using CLIP_RUN = bool (*)(WAVE_16BS *Out, const WAVE_32BS *In, uint32_t Length);
+using CLIP_PLANAR = bool (*)(WAVE_16BS *Out, const int32_t *Left, const int32_t *Right, uint32_t Length, int32_t Volume);
+using MIX_RUN = void (*)(WAVE_32BS *Bus, const WAVE_32BS *In, uint32_t Length, const ChipMix &Mix);
+static_assert(sizeof(WAVE_32BS) == 8 && sizeof(WAVE_16BS) == 4);
+
+INLINE int32_t AddSaturated(int32_t Bus, int32_t Value){
+	return static_cast<int32_t>(std::clamp<int64_t>(static_cast<int64_t>(Bus) + Value, INT32_MIN, INT32_MAX));
+}
+
+static bool ClipRunScalar(WAVE_16BS *Out, const WAVE_32BS *In, uint32_t Length){
+	bool Loud = false;
+	for(uint32_t Smpl = 0x00; Smpl < Length; Smpl++){
+		int32_t Left = In[Smpl].Left >> 7;
+		int32_t Right = In[Smpl].Right >> 7;
+		Loud = Loud || std::abs(Left) > SILENCE_PEAK || std::abs(Right) > SILENCE_PEAK;
+		Out[Smpl].Left = Limit2Short(Left);
+		Out[Smpl].Right = Limit2Short(Right);
+	}
+	return Loud;
+}
+
+static void MixRunScalar(WAVE_32BS *Bus, const WAVE_32BS *In, uint32_t Length, const ChipMix &Mix){
+	for(uint32_t Smpl = 0x00; Smpl < Length; Smpl++){
+		Bus[Smpl].Left = AddSaturated(Bus[Smpl].Left, static_cast<int32_t>(std::lrint(static_cast<float>(In[Smpl].Left) * Mix.Left)));
+		Bus[Smpl].Right = AddSaturated(Bus[Smpl].Right, static_cast<int32_t>(std::lrint(static_cast<float>(In[Smpl].Right) * Mix.Right)));
+	}
+}
+
+static bool ClipPlanarScalar(WAVE_16BS *Out, const int32_t *Left, const int32_t *Right, uint32_t Length, int32_t Volume){
+	bool Loud = false;
+	for(uint32_t Smpl = 0x00; Smpl < Length; Smpl++){
+		int32_t L = Left[Smpl] * Volume >> 7;
+		int32_t R = Right[Smpl] * Volume >> 7;
+		Loud = Loud || std::abs(L) > SILENCE_PEAK || std::abs(R) > SILENCE_PEAK;
+		Out[Smpl].Left = Limit2Short(L);
+		Out[Smpl].Right = Limit2Short(R);
+	}
+	return Loud;
+}
+
+#ifdef OPN_SSE2
+static bool ClipRunSSE2(WAVE_16BS *Out, const WAVE_32BS *In, uint32_t Length){
+	uint32_t Smpl = 0x00;
+	const __m128i Peak = _mm_set1_epi32(SILENCE_PEAK);
+	const __m128i NegPeak = _mm_set1_epi32(-SILENCE_PEAK);
+	__m128i Above = _mm_setzero_si128();
+	for(; Smpl + 4 <= Length; Smpl += 4){
+		__m128i Lo = _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&In[Smpl])), 7);
+		__m128i Hi = _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&In[Smpl + 2])), 7);
+		Above = _mm_or_si128(Above, _mm_or_si128(_mm_cmpgt_epi32(Lo, Peak), _mm_cmplt_epi32(Lo, NegPeak)));
+		Above = _mm_or_si128(Above, _mm_or_si128(_mm_cmpgt_epi32(Hi, Peak), _mm_cmplt_epi32(Hi, NegPeak)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&Out[Smpl]), _mm_packs_epi32(Lo, Hi));    // saturating
+	}
+	bool Tail = ClipRunScalar(&Out[Smpl], &In[Smpl], Length - Smpl);
+	return _mm_movemask_epi8(Above) != 0 || Tail;
+}
+
+static void MixRunSSE2(WAVE_32BS *Bus, const WAVE_32BS *In, uint32_t Length, const ChipMix &Mix){
+	uint32_t Smpl = 0x00;
+	const __m128 Gain = _mm_setr_ps(Mix.Left, Mix.Right, Mix.Left, Mix.Right);
+	const __m128i Max = _mm_set1_epi32(INT32_MAX);
+	for(; Smpl + 2 <= Length; Smpl += 2){
+		__m128 Scaled = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&In[Smpl]))), Gain);
+		__m128i Acc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&Bus[Smpl]));
+		__m128i Add = _mm_cvtps_epi32(Scaled);
+		__m128i Sum = _mm_add_epi32(Acc, Add);
+		// overflowed where both have the same sign and the sum hasn't, those go to the limit of that sign
+		__m128i Over = _mm_srai_epi32(_mm_andnot_si128(_mm_xor_si128(Acc, Add), _mm_xor_si128(Acc, Sum)), 31);
+		__m128i Limit = _mm_xor_si128(_mm_srai_epi32(Acc, 31), Max);
+		Sum = _mm_or_si128(_mm_and_si128(Over, Limit), _mm_andnot_si128(Over, Sum));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&Bus[Smpl]), Sum);
+	}
+	MixRunScalar(&Bus[Smpl], &In[Smpl], Length - Smpl, Mix);
+}
+
+// SSE2 has no 32 bit multiply keeping the low half, two 64 bit ones give it
+INLINE __m128i MulLow32(__m128i Value, __m128i Factor){
+	__m128i Even = _mm_mul_epu32(Value, Factor);
+	__m128i Odd = _mm_mul_epu32(_mm_srli_epi64(Value, 32), Factor);
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(Even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(Odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static bool ClipPlanarSSE2(WAVE_16BS *Out, const int32_t *Left, const int32_t *Right, uint32_t Length, int32_t Volume){
+	uint32_t Smpl = 0x00;
+	const __m128i Factor = _mm_set1_epi32(Volume);
+	const __m128i Peak = _mm_set1_epi32(SILENCE_PEAK);
+	const __m128i NegPeak = _mm_set1_epi32(-SILENCE_PEAK);
+	__m128i Above = _mm_setzero_si128();
+	for(; Smpl + 4 <= Length; Smpl += 4){
+		__m128i L = _mm_srai_epi32(MulLow32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&Left[Smpl])), Factor), 7);
+		__m128i R = _mm_srai_epi32(MulLow32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&Right[Smpl])), Factor), 7);
+		Above = _mm_or_si128(Above, _mm_or_si128(_mm_cmpgt_epi32(L, Peak), _mm_cmplt_epi32(L, NegPeak)));
+		Above = _mm_or_si128(Above, _mm_or_si128(_mm_cmpgt_epi32(R, Peak), _mm_cmplt_epi32(R, NegPeak)));
+		__m128i Packed = _mm_packs_epi32(_mm_unpacklo_epi32(L, R), _mm_unpackhi_epi32(L, R));    // saturating
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&Out[Smpl]), Packed);
+	}
+	bool Tail = ClipPlanarScalar(&Out[Smpl], &Left[Smpl], &Right[Smpl], Length - Smpl, Volume);
+	return _mm_movemask_epi8(Above) != 0 || Tail;
+}
+
+OPN_TARGET("avx2")
+static bool ClipRunAVX2(WAVE_16BS *Out, const WAVE_32BS *In, uint32_t Length){
+	uint32_t Smpl = 0x00;
+	const __m256i Peak = _mm256_set1_epi32(SILENCE_PEAK);
+	const __m256i NegPeak = _mm256_set1_epi32(-SILENCE_PEAK);
+	__m256i Above = _mm256_setzero_si256();
+	for(; Smpl + 8 <= Length; Smpl += 8){
+		__m256i Lo = _mm256_srai_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&In[Smpl])), 7);
+		__m256i Hi = _mm256_srai_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&In[Smpl + 4])), 7);
+		Above = _mm256_or_si256(Above, _mm256_or_si256(_mm256_cmpgt_epi32(Lo, Peak), _mm256_cmpgt_epi32(NegPeak, Lo)));
+		Above = _mm256_or_si256(Above, _mm256_or_si256(_mm256_cmpgt_epi32(Hi, Peak), _mm256_cmpgt_epi32(NegPeak, Hi)));
+		// the pack works per 128 bit lane, frames 0-1 4-5 2-3 6-7 go back in order
+		__m256i Packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(Lo, Hi), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&Out[Smpl]), Packed);
+	}
+	bool Tail = ClipRunSSE2(&Out[Smpl], &In[Smpl], Length - Smpl);
+	return _mm256_movemask_epi8(Above) != 0 || Tail;
+}
+
+OPN_TARGET("avx2")
+static void MixRunAVX2(WAVE_32BS *Bus, const WAVE_32BS *In, uint32_t Length, const ChipMix &Mix){
+	uint32_t Smpl = 0x00;
+	const __m256 Gain = _mm256_setr_ps(Mix.Left, Mix.Right, Mix.Left, Mix.Right, Mix.Left, Mix.Right, Mix.Left, Mix.Right);
+	const __m256i Max = _mm256_set1_epi32(INT32_MAX);
+	for(; Smpl + 4 <= Length; Smpl += 4){
+		__m256 Scaled = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&In[Smpl]))), Gain);
+		__m256i Acc = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&Bus[Smpl]));
+		__m256i Add = _mm256_cvtps_epi32(Scaled);
+		__m256i Sum = _mm256_add_epi32(Acc, Add);
+		__m256i Over = _mm256_srai_epi32(_mm256_andnot_si256(_mm256_xor_si256(Acc, Add), _mm256_xor_si256(Acc, Sum)), 31);
+		__m256i Limit = _mm256_xor_si256(_mm256_srai_epi32(Acc, 31), Max);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&Bus[Smpl]), _mm256_blendv_epi8(Sum, Limit, Over));
+	}
+	MixRunSSE2(&Bus[Smpl], &In[Smpl], Length - Smpl, Mix);
+}
+
+OPN_TARGET("avx2")
+static bool ClipPlanarAVX2(WAVE_16BS *Out, const int32_t *Left, const int32_t *Right, uint32_t Length, int32_t Volume){
+	uint32_t Smpl = 0x00;
+	const __m256i Factor = _mm256_set1_epi32(Volume);
+	const __m256i Peak = _mm256_set1_epi32(SILENCE_PEAK);
+	const __m256i NegPeak = _mm256_set1_epi32(-SILENCE_PEAK);
+	__m256i Above = _mm256_setzero_si256();
+	for(; Smpl + 8 <= Length; Smpl += 8){
+		__m256i L = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&Left[Smpl])), Factor), 7);
+		__m256i R = _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(&Right[Smpl])), Factor), 7);
+		Above = _mm256_or_si256(Above, _mm256_or_si256(_mm256_cmpgt_epi32(L, Peak), _mm256_cmpgt_epi32(NegPeak, L)));
+		Above = _mm256_or_si256(Above, _mm256_or_si256(_mm256_cmpgt_epi32(R, Peak), _mm256_cmpgt_epi32(NegPeak, R)));
+		// unpack and pack both work per 128 bit lane, so frames 0-3 and 4-7 come out in order without a permute
+		__m256i Packed = _mm256_packs_epi32(_mm256_unpacklo_epi32(L, R), _mm256_unpackhi_epi32(L, R));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&Out[Smpl]), Packed);
+	}
+	bool Tail = ClipPlanarSSE2(&Out[Smpl], &Left[Smpl], &Right[Smpl], Length - Smpl, Volume);
+	return _mm256_movemask_epi8(Above) != 0 || Tail;
+}
+#endif
+
+#ifdef OPN_NEON
+static bool ClipRunNEON(WAVE_16BS *Out, const WAVE_32BS *In, uint32_t Length){
+	uint32_t Smpl = 0x00;
+	const int32x4_t Peak = vdupq_n_s32(SILENCE_PEAK);
+	uint32x4_t Above = vdupq_n_u32(0);
+	for(; Smpl + 4 <= Length; Smpl += 4){
+		int32x4_t Lo = vshrq_n_s32(vld1q_s32(&In[Smpl].Left), 7);
+		int32x4_t Hi = vshrq_n_s32(vld1q_s32(&In[Smpl + 2].Left), 7);
+		Above = vorrq_u32(Above, vorrq_u32(vcgtq_s32(vabsq_s32(Lo), Peak), vcgtq_s32(vabsq_s32(Hi), Peak)));
+		vst1q_s16(&Out[Smpl].Left, vcombine_s16(vqmovn_s32(Lo), vqmovn_s32(Hi)));    // saturating
+	}
+	bool Tail = ClipRunScalar(&Out[Smpl], &In[Smpl], Length - Smpl);
+	return vmaxvq_u32(Above) != 0 || Tail;
+}
+
+static void MixRunNEON(WAVE_32BS *Bus, const WAVE_32BS *In, uint32_t Length, const ChipMix &Mix){
+	uint32_t Smpl = 0x00;
+	const float32x4_t Gain = {Mix.Left, Mix.Right, Mix.Left, Mix.Right};
+	for(; Smpl + 2 <= Length; Smpl += 2){
+		float32x4_t Scaled = vmulq_f32(vcvtq_f32_s32(vld1q_s32(&In[Smpl].Left)), Gain);
+		vst1q_s32(&Bus[Smpl].Left, vqaddq_s32(vld1q_s32(&Bus[Smpl].Left), vcvtnq_s32_f32(Scaled)));    // to nearest even, as lrint
+	}
+	MixRunScalar(&Bus[Smpl], &In[Smpl], Length - Smpl, Mix);
+}
+
+static bool ClipPlanarNEON(WAVE_16BS *Out, const int32_t *Left, const int32_t *Right, uint32_t Length, int32_t Volume){
+	uint32_t Smpl = 0x00;
+	const int32x4_t Peak = vdupq_n_s32(SILENCE_PEAK);
+	uint32x4_t Above = vdupq_n_u32(0);
+	for(; Smpl + 4 <= Length; Smpl += 4){
+		int32x4_t L = vshrq_n_s32(vmulq_n_s32(vld1q_s32(&Left[Smpl]), Volume), 7);
+		int32x4_t R = vshrq_n_s32(vmulq_n_s32(vld1q_s32(&Right[Smpl]), Volume), 7);
+		Above = vorrq_u32(Above, vorrq_u32(vcgtq_s32(vabsq_s32(L), Peak), vcgtq_s32(vabsq_s32(R), Peak)));
+		vst2_s16(&Out[Smpl].Left, int16x4x2_t{{vqmovn_s32(L), vqmovn_s32(R)}});    // saturating, interleaved on the store
+	}
+	bool Tail = ClipPlanarScalar(&Out[Smpl], &Left[Smpl], &Right[Smpl], Length - Smpl, Volume);
+	return vmaxvq_u32(Above) != 0 || Tail;
+}
+#endif
+
+struct MIX_KERNELS {
+	CLIP_RUN ClipRun;
+	MIX_RUN MixRun;
+	CLIP_PLANAR ClipPlanar;
+};
+
+static MIX_KERNELS MixKernelsFor(CPUFeatureLevel Level, FM_ISA Isa){
+	if(Level == CPUFeatureLevel::Scalar){
+		return {ClipRunScalar, MixRunScalar, ClipPlanarScalar};
+	}
+#if defined(OPN_NEON)
+	static_cast<void>(Isa);
+	return {ClipRunNEON, MixRunNEON, ClipPlanarNEON};    // every AArch64 CPU has it, whatever path the core takes
+#elif defined(OPN_SSE2)
+	switch(Isa){
+		case FM_ISA::SSE41: return {ClipRunSSE2, MixRunSSE2, ClipPlanarSSE2};
+		case FM_ISA::AVX2:
+		case FM_ISA::AVX512: return {ClipRunAVX2, MixRunAVX2, ClipPlanarAVX2};    // nothing to gain from 512 bit on runs this short
+		default: return {ClipRunScalar, MixRunScalar, ClipPlanarScalar};
+	}
+#else
+	static_cast<void>(Isa);
+	return {ClipRunScalar, MixRunScalar, ClipPlanarScalar};
+#endif
+}
+
+static MIX_KERNELS MixKernels = {ClipRunScalar, MixRunScalar, ClipPlanarScalar};
+
+static void SelectMixKernels(CPUFeatureLevel Level, FM_ISA Isa){
+	MixKernels = MixKernelsFor(Level, Isa);
+}
+
+// I recommend 11 bits as it's fast and accurate
+const uint32_t FIXPNT_BITS = 11;
+const uint32_t FIXPNT_FACT = 1 << FIXPNT_BITS;
+#if (FIXPNT_BITS <= 11)
+using SLINT = uint32_t;    // 32-bit is a lot faster
+#else
+typedef uint64_t	SLINT;
+#endif
+const uint32_t FIXPNT_MASK = FIXPNT_FACT - 1;
+
+INLINE uint32_t getfriction(uint32_t x){
+	return x & FIXPNT_MASK;
+}
+
+INLINE uint32_t getnfriction(uint32_t x){
+	return (FIXPNT_FACT - x) & FIXPNT_MASK;
+}
+
+INLINE uint32_t fpi_floor(uint32_t x){
+	return (x) & ~FIXPNT_MASK;
+}
+
+INLINE uint32_t fpi_ceil(uint32_t x){
+	return (x + FIXPNT_MASK) & ~FIXPNT_MASK;
+}
+
+INLINE uint32_t fp2i_floor(uint32_t x){
+	return (x) / FIXPNT_FACT;
+}
+
+INLINE uint32_t fp2i_ceil(uint32_t x){
+	return (x + FIXPNT_MASK) / FIXPNT_FACT;
+}
+
+// The host's clock and the sound device's crystal never run at exactly the rates they claim, so a chip run by
+// OPN_RunCycles is resampled at a ratio trimmed by up to DRC_MAX_DEVIATION to keep its queue at QueueLatency.
+// The ratio only moves by a few ppm per callback, far below what's audible as a pitch change.
+constexpr double DRC_MAX_DEVIATION = 0.005;
+constexpr double DRC_KP = DRC_MAX_DEVIATION;    // full correction at twice/zero the target fill
+constexpr double DRC_KI = DRC_KP / 2.0;         // the integral takes over within a few seconds
+constexpr double DRC_FILL_SECONDS = 0.1;        // low pass for the fill, the host adds whole video frames at once
+
+static void AdjustQueueRate(SampleQueue *Queue, uint32_t Frames){
+	if(!Queue->Primed){
+		return;
+	}
+	double Seconds = static_cast<double>(Frames) / SampleRate;
+	Queue->Fill += (static_cast<double>(Queue->Write - Queue->Read) - Queue->Fill) * std::min(1.0, Seconds / DRC_FILL_SECONDS);
+
+	double Error = (Queue->Fill - QueueLatency) / QueueLatency;    // > 0: too much buffered, play faster
+	Queue->Integral = std::clamp(Queue->Integral + Error * Seconds, -DRC_MAX_DEVIATION / DRC_KI, DRC_MAX_DEVIATION / DRC_KI);
+	Queue->Ratio = 1.0 + std::clamp(DRC_KP * Error + DRC_KI * Queue->Integral, -DRC_MAX_DEVIATION, DRC_MAX_DEVIATION);
+}
+
+// Linear interpolation at a fractional step, so the ratio can change at any sample without a discontinuity
+static void ResampleQueue(uint8_t ChipID, WAVE_32BS *RetSample, uint32_t Length){
+	ChipAudioAttributes *CAA = &ChipSlots[ChipID].Audio;
+	SampleQueue *Queue = ChipSlots[ChipID].Queue;
+	auto Step = static_cast<uint64_t>(static_cast<double>(CAA->SmpRate) / SampleRate * Queue->Ratio * 0x100000000);
+	int32_t *Buffers[0x02] = {StreamBufs[0x00], StreamBufs[0x01]};
+
+	for(uint32_t OutPos = 0x00; OutPos < Length; OutPos++){
+		if(!Queue->Primed){
+			// hold the last sample until there's enough buffered again, then start the controller from scratch
+			if(Queue->Write - Queue->Read < QueueLatency){
+				RetSample[OutPos].Left += Queue->NextL * CAA->Volume;
+				RetSample[OutPos].Right += Queue->NextR * CAA->Volume;
+				continue;
+			}
+			Queue->Primed = true;
+			Queue->Fill = QueueLatency;
+			Queue->Integral = 0.0;
+			Queue->Ratio = 1.0;
+		}
+
+		Queue->Phase += Step;
+		if(Queue->Phase >= 0x100000000){
+			auto Taken = static_cast<size_t>(Queue->Phase >> 32);
+			if(Queue->Write - Queue->Read < Taken){
+				Queue->Primed = false;    // the host stalled
+			}
+			PopChipQueue(ChipID, Buffers, Taken);
+			Queue->PrevL = Taken > 1 ? Buffers[0x00][Taken - 2] : Queue->NextL;
+			Queue->PrevR = Taken > 1 ? Buffers[0x01][Taken - 2] : Queue->NextR;
+			Queue->NextL = Buffers[0x00][Taken - 1];
+			Queue->NextR = Buffers[0x01][Taken - 1];
+			Queue->Phase &= 0xFFFFFFFF;
+		}
+		auto Frac = static_cast<int64_t>(Queue->Phase >> 16);    // 16 bit are plenty
+		int32_t Left = Queue->PrevL + static_cast<int32_t>(((Queue->NextL - Queue->PrevL) * Frac) >> 16);
+		int32_t Right = Queue->PrevR + static_cast<int32_t>(((Queue->NextR - Queue->PrevR) * Frac) >> 16);
+		RetSample[OutPos].Left += Left * CAA->Volume;
+		RetSample[OutPos].Right += Right * CAA->Volume;
+	}
+}
+
+// The copy resampler's chip samples for a run, left in StreamBufs
+static void CopyChipStream(uint8_t ChipID, uint32_t Length){
+	ChipAudioAttributes *CAA = &ChipSlots[ChipID].Audio;
+	CAA->SmpNext = static_cast<uint32_t>(static_cast<uint64_t>(CAA->SmpP) * CAA->SmpRate / SampleRate);
+	GetChipStream(ChipID, StreamBufs, Length);
+	CAA->SmpP += Length;
+	CAA->SmpLast = CAA->SmpNext;
+}
+
+static void ResampleChipStream(uint8_t ChipID, WAVE_32BS *RetSample, uint32_t Length){
+	OPN_TRACE_SCOPE("Resample", ChipID);
+	if(ChipSlots[ChipID].Queue != nullptr){
+		ResampleQueue(ChipID, RetSample, Length);
+		return;
+	}
+	ChipAudioAttributes *CAA = &ChipSlots[ChipID].Audio;
+	int32_t *CurBufL = StreamBufs[0x00];
+	int32_t *CurBufR = StreamBufs[0x01];
+	int32_t *StreamPnt[0x02];
+	uint32_t InBase;
+	uint32_t InPos;
+	uint32_t InPosNext;
+	uint32_t InStep;
+	uint32_t OutPos;
+	uint32_t SmpFrc;    // Sample Friction
+	uint32_t InPre = 0;
+	uint32_t InNow;
+	SLINT InPosL;
+	int64_t TempSmpL;
+	int64_t TempSmpR;
+	int32_t TempS32L;
+	int32_t TempS32R;
+	int32_t SmpCnt;    // must be signed, else I'm getting calculation errors
+	int32_t CurSmpl;
+	uint64_t ChipSmpRate;
+
+	switch(CAA->Resampler){
+		case 0x00:    // old, but very fast resampler
+			CAA->SmpLast = CAA->SmpNext;
+			CAA->SmpP += Length;
+			CAA->SmpNext = static_cast<uint32_t>(static_cast<uint64_t>(CAA->SmpP) * CAA->SmpRate / SampleRate);
+			if(CAA->SmpLast >= CAA->SmpNext){
+				RetSample->Left += CAA->LSmpl.Left * CAA->Volume;
+				RetSample->Right += CAA->LSmpl.Right * CAA->Volume;
+			}else{
+				SmpCnt = static_cast<int32_t>(CAA->SmpNext - CAA->SmpLast);
+
+				GetChipStream(ChipID, StreamBufs, SmpCnt);
+
+				if(SmpCnt == 1){
+					RetSample->Left += CurBufL[0x00] * CAA->Volume;
+					RetSample->Right += CurBufR[0x00] * CAA->Volume;
+					CAA->LSmpl.Left = CurBufL[0x00];
+					CAA->LSmpl.Right = CurBufR[0x00];
+				}else if(SmpCnt == 2){
+					RetSample->Left += (CurBufL[0x00] + CurBufL[0x01]) * CAA->Volume >> 1;
+					RetSample->Right += (CurBufR[0x00] + CurBufR[0x01]) * CAA->Volume >> 1;
+					CAA->LSmpl.Left = CurBufL[0x01];
+					CAA->LSmpl.Right = CurBufR[0x01];
+				}else{
+					TempS32L = CurBufL[0x00];
+					TempS32R = CurBufR[0x00];
+					for(CurSmpl = 0x01; CurSmpl < SmpCnt; CurSmpl++){
+						TempS32L += CurBufL[CurSmpl];
+						TempS32R += CurBufR[CurSmpl];
+					}
+					RetSample->Left += TempS32L * CAA->Volume / SmpCnt;
+					RetSample->Right += TempS32R * CAA->Volume / SmpCnt;
+					CAA->LSmpl.Left = CurBufL[SmpCnt - 1];
+					CAA->LSmpl.Right = CurBufR[SmpCnt - 1];
+				}
+			}
+			break;
+		case 0x01:    // Upsampling
+			// every position is taken from the absolute output position, so a run sounds the same however it's split
+			ChipSmpRate = CAA->SmpRate;
+			InPosL = static_cast<SLINT>(static_cast<uint64_t>(FIXPNT_FACT) * (CAA->SmpP + Length - 1) * ChipSmpRate / SampleRate);
+
+			CurBufL[0x00] = CAA->LSmpl.Left;
+			CurBufR[0x00] = CAA->LSmpl.Right;
+			CurBufL[0x01] = CAA->NSmpl.Left;
+			CurBufR[0x01] = CAA->NSmpl.Right;
+			StreamPnt[0x00] = &CurBufL[0x02];
+			StreamPnt[0x01] = &CurBufR[0x02];
+			GetChipStream(ChipID, StreamPnt, fp2i_ceil(InPosL) - CAA->SmpNext);
+
+			InBase = FIXPNT_FACT - CAA->SmpNext * FIXPNT_FACT;    // wraps around, the positions are never before it
+			SmpCnt = FIXPNT_FACT;
+			CAA->SmpLast = fp2i_floor(InPosL);
+			CAA->SmpNext = fp2i_ceil(InPosL);
+			InNow = 0;
+			for(OutPos = 0x00; OutPos < Length; OutPos++){
+				InPos = InBase + static_cast<uint32_t>(static_cast<uint64_t>(FIXPNT_FACT) * (CAA->SmpP + OutPos) * ChipSmpRate / SampleRate);
+
+				InPre = fp2i_floor(InPos);
+				InNow = fp2i_ceil(InPos);
+				SmpFrc = getfriction(InPos);
+
+				// Linear interpolation
+				TempSmpL = (static_cast<int64_t>(CurBufL[InPre]) * (FIXPNT_FACT - SmpFrc))
+				           + (static_cast<int64_t>(CurBufL[InNow]) * SmpFrc);
+				TempSmpR = (static_cast<int64_t>(CurBufR[InPre]) * (FIXPNT_FACT - SmpFrc))
+				           + (static_cast<int64_t>(CurBufR[InNow]) * SmpFrc);
+				RetSample[OutPos].Left += static_cast<int32_t>(TempSmpL * CAA->Volume / SmpCnt);
+				RetSample[OutPos].Right += static_cast<int32_t>(TempSmpR * CAA->Volume / SmpCnt);
+			}
+			CAA->LSmpl.Left = CurBufL[InPre];
+			CAA->LSmpl.Right = CurBufR[InPre];
+			CAA->NSmpl.Left = CurBufL[InNow];
+			CAA->NSmpl.Right = CurBufR[InNow];
+			CAA->SmpP += Length;
+			break;
+		case 0x02:    // Copying
+			CopyChipStream(ChipID, Length);
+			for(OutPos = 0x00; OutPos < Length; OutPos++){
+				RetSample[OutPos].Left += CurBufL[OutPos] * CAA->Volume;
+				RetSample[OutPos].Right += CurBufR[OutPos] * CAA->Volume;
+			}
+			break;
+		case 0x03:    // Downsampling
+			ChipSmpRate = CAA->SmpRate;
+			InPosL = static_cast<SLINT>(static_cast<uint64_t>(FIXPNT_FACT) * (CAA->SmpP + Length) * ChipSmpRate / SampleRate);
+			CAA->SmpNext = fp2i_ceil(InPosL);
+
+			CurBufL[0x00] = CAA->LSmpl.Left;
+			CurBufR[0x00] = CAA->LSmpl.Right;
+			StreamPnt[0x00] = &CurBufL[0x01];
+			StreamPnt[0x01] = &CurBufR[0x01];
+			GetChipStream(ChipID, StreamPnt, CAA->SmpNext - CAA->SmpLast);
+
+			// I'm adding 1.0 to avoid negative indexes.
+			// Each output sample averages one step from its absolute position on, the same in runs of any length.
+			InBase = FIXPNT_FACT - CAA->SmpLast * FIXPNT_FACT;
+			InStep = static_cast<uint32_t>(FIXPNT_FACT * ChipSmpRate / SampleRate);
+			for(OutPos = 0x00; OutPos < Length; OutPos++){
+				InPos = InBase + static_cast<uint32_t>(static_cast<uint64_t>(FIXPNT_FACT) * (CAA->SmpP + OutPos) * ChipSmpRate / SampleRate);
+				InPosNext = InPos + InStep;
+
+				// first frictional Sample
+				SmpFrc = getnfriction(InPos);
+				if(SmpFrc){
+					InPre = fp2i_floor(InPos);
+					TempSmpL = static_cast<int64_t>(CurBufL[InPre]) * SmpFrc;
+					TempSmpR = static_cast<int64_t>(CurBufR[InPre]) * SmpFrc;
+				}else{
+					TempSmpL = TempSmpR = 0x00;
+				}
+				SmpCnt = static_cast<int32_t>(SmpFrc);
+
+				// last frictional Sample
+				SmpFrc = getfriction(InPosNext);
+				InPre = fp2i_floor(InPosNext);
+				if(SmpFrc){
+					TempSmpL += static_cast<int64_t>(CurBufL[InPre]) * SmpFrc;
+					TempSmpR += static_cast<int64_t>(CurBufR[InPre]) * SmpFrc;
+					SmpCnt += static_cast<int32_t>(SmpFrc);
+				}
+
+				// whole Samples in between
+				InNow = fp2i_ceil(InPos);
+				SmpCnt += static_cast<int32_t>((InPre - InNow) * FIXPNT_FACT);    // this is faster
+				while(InNow < InPre){
+					TempSmpL += static_cast<int64_t>(CurBufL[InNow]) * FIXPNT_FACT;
+					TempSmpR += static_cast<int64_t>(CurBufR[InNow]) * FIXPNT_FACT;
+					InNow++;
+				}
+
+				RetSample[OutPos].Left += static_cast<int32_t>(TempSmpL * CAA->Volume / SmpCnt);
+				RetSample[OutPos].Right += static_cast<int32_t>(TempSmpR * CAA->Volume / SmpCnt);
+			}
+
+			CAA->LSmpl.Left = CurBufL[InPre];
+			CAA->LSmpl.Right = CurBufR[InPre];
+			CAA->SmpP += Length;
+			CAA->SmpLast = CAA->SmpNext;
+			break;
+		default:
+			CAA->SmpP += SampleRate;
+			break;    // do absolutely nothing
+	}
+
+	if(CAA->SmpLast >= CAA->SmpRate){
+		CAA->SmpLast -= CAA->SmpRate;
+		CAA->SmpNext -= CAA->SmpRate;
+		CAA->SmpP -= SampleRate;
+	}
+}
+
+// Runs chip samples that nobody listens to, only the last two are rendered for LSmpl/NSmpl
+static void DiscardChipStream(uint8_t ChipID, uint32_t Samples){
+	ChipAudioAttributes *CAA = &ChipSlots[ChipID].Audio;
+
+	if(Samples > 2){
+		AdvanceChipStream(ChipID, Samples - 2);
+		Samples = 2;
+	}
+	while(Samples){
+		uint32_t ChunkSize = std::min(Samples, SMPL_BUFSIZE);
+		GetChipStream(ChipID, StreamBufs, ChunkSize);
+		Samples -= ChunkSize;
+
+		CAA->NSmpl.Left = StreamBufs[0x00][ChunkSize - 1];
+		CAA->NSmpl.Right = StreamBufs[0x01][ChunkSize - 1];
+		if(ChunkSize >= 2){
+			CAA->LSmpl.Left = StreamBufs[0x00][ChunkSize - 2];
+			CAA->LSmpl.Right = StreamBufs[0x01][ChunkSize - 2];
+		}else{
+			CAA->LSmpl = CAA->NSmpl;
+		}
+	}
+}
+
+// Advances a chip by Length output samples without resampling.
+// The chip renders exactly the samples ResampleChipStream would have consumed, but the interpolation
+// is skipped. LSmpl/NSmpl are only approximated, so a few samples have to go through
+// ResampleChipStream afterwards (see SkipTailLength).
+static void SkipChipStream(uint8_t ChipID, uint32_t Length){
+	ChipAudioAttributes *CAA = &ChipSlots[ChipID].Audio;
+	uint64_t ChipSmpRate = CAA->SmpRate;
+
+	while(Length){
+		// the sample counters only stay inside 32 bits for up to one second
+		uint32_t StepSize = std::min(Length, SampleRate);
+		uint32_t SmpP = CAA->SmpP + StepSize;
+		uint32_t Rendered;
+		Length -= StepSize;
+
+		switch(CAA->Resampler){
+			case 0x00:
+				Rendered = CAA->SmpNext;
+				CAA->SmpLast = static_cast<uint32_t>((SmpP - 1) * ChipSmpRate / SampleRate);
+				CAA->SmpNext = static_cast<uint32_t>(SmpP * ChipSmpRate / SampleRate);
+				DiscardChipStream(ChipID, CAA->SmpNext - Rendered);
+				break;
+			case 0x01:
+				Rendered = CAA->SmpNext;
+				CAA->SmpLast = fp2i_floor(static_cast<SLINT>(FIXPNT_FACT * (SmpP - 1) * ChipSmpRate / SampleRate));
+				CAA->SmpNext = fp2i_ceil(static_cast<SLINT>(FIXPNT_FACT * (SmpP - 1) * ChipSmpRate / SampleRate));
+				DiscardChipStream(ChipID, CAA->SmpNext - Rendered);
+				break;
+			case 0x02:
+				DiscardChipStream(ChipID, StepSize);
+				CAA->SmpLast = CAA->SmpNext = SmpP - 1;
+				break;
+			case 0x03:
+				Rendered = CAA->SmpLast;
+				CAA->SmpNext = fp2i_ceil(static_cast<SLINT>(FIXPNT_FACT * SmpP * ChipSmpRate / SampleRate));
+				CAA->SmpLast = CAA->SmpNext;
+				DiscardChipStream(ChipID, CAA->SmpNext - Rendered);
+				break;
+			default:
+				SmpP = CAA->SmpP;    // nothing to render, see ResampleChipStream
+				break;
+		}
+		CAA->SmpP = SmpP;
+
+		while(CAA->SmpRate && CAA->SmpLast >= CAA->SmpRate){
+			CAA->SmpLast -= CAA->SmpRate;
+			CAA->SmpNext -= CAA->SmpRate;
+			CAA->SmpP -= SampleRate;
+		}
+	}
+}
+
+// Number of output samples that have to be resampled properly at the end of a skip.
+// They have to cover at least two chip samples, so that LSmpl/NSmpl are exact again.
+static uint32_t SkipTailLength(const ChipAudioAttributes *CAA){
+	if(!CAA->SmpRate){
+		return 0;
+	}
+	return 2 + (2 * SampleRate + CAA->SmpRate - 1) / CAA->SmpRate;
+}
+
+static void UpdateDAC(uint8_t ChipID, uint32_t Samples){
+	DACState *TempDAC = &ChipSlots[ChipID].DAC;
+	if(TempDAC->Data == nullptr){
+		return;
+	}
+	OPN_TRACE_SCOPE("DAC update", ChipID);
+
+	//RemDelta = TempDAC->Delta * Samples;
+	TempDAC->SmplFric += TempDAC->Delta * Samples;
+	if(TempDAC->SmplFric & 0xFFFF0000){
+		TempDAC->SmplPos += (TempDAC->SmplFric >> 16);
+		TempDAC->SmplFric &= 0x0000FFFF;
+		if(TempDAC->SmplPos >= TempDAC->DataSize){
+			TempDAC->Data = nullptr;
+			ym2612_w(ChipID, 0x00, 0x2A);
+			ym2612_w(ChipID, 0x01, 0x80);
+			return;
+		}
+
+		ym2612_w(ChipID, 0x00, 0x2A);
+		if(TempDAC->Volume == 0x100){
+			ym2612_w(ChipID, 0x01, TempDAC->Data[TempDAC->SmplPos]);
+		}else{
+			int32_t SmplData = TempDAC->Data[TempDAC->SmplPos] - 0x80;    // 00..80..FF -> -80..00..+7F
+			SmplData *= TempDAC->Volume;
+			SmplData = (SmplData + 0x80) >> 8;    // +0x80 for proper rounding
+			if(SmplData < -0x80){
+				SmplData = -0x80;
+			}else if(SmplData > 0x7F){
+				SmplData = 0x7F;
+			}
+			ym2612_w(ChipID, 0x01, (uint8_t) (SmplData + 0x80));    // YM2612 takes 00..FF
+		}
+		NullSamples = 0;    // keep everything running while the DAC is playing
+	}
+}
+
+static bool TimerRunning(){
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		if(ym2612_timer_running(CurChip)){
+			return true;
+		}
+	}
+	return false;
+}
+
+// Every chip has gone quiet for good and no DAC sample is playing, only a register write can change that.
+// Chips the host runs itself (OPN_RunCycles) may still have samples queued.
+static bool ChipsIdle(){
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		const ChipSlot &Slot = ChipSlots[CurChip];
+		if(Slot.DAC.Data != nullptr || Slot.Queue != nullptr || !ym2612_silent(CurChip)){
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool BusSafe = true;    // all chips at full scale can't overflow the bus, see LoadChipMix
+// A single chip copied at unity gain is clipped straight from StreamBufs, without going through the bus.
+// With more chips the bus stays: the core renders each one into its own planar L/R buffers, those have to be
+// summed somewhere before the clip, and the bus is that sum.
+static bool ClipDirect = false;
+
+// Gain and pan of every chip for the coming buffer (or up to the next tick), read once instead of on every frame
+static void LoadChipMix(){
+	double Peak = 0.0;
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		ChipSlot &Slot = ChipSlots[CurChip];
+		uint32_t Setting = MixSettings[CurChip].load(std::memory_order_relaxed);
+		float Gain = static_cast<float>(Setting >> 8) / MIX_UNITY;
+		auto Pan = static_cast<float>(static_cast<int8_t>(Setting & 0xFF));
+		Slot.Mix.Left = Gain * std::min(1.0f, (127.0f - Pan) / 127.0f);
+		Slot.Mix.Right = Gain * std::min(1.0f, (127.0f + Pan) / 127.0f);
+		Slot.Mix.Unity = Slot.Mix.Left == 1.0f && Slot.Mix.Right == 1.0f;
+		Peak += static_cast<double>(CHIP_PEAK) * Slot.Audio.Volume * std::max(Slot.Mix.Left, Slot.Mix.Right);
+	}
+	BusSafe = Peak <= INT32_MAX;
+	const ChipSlot &First = ChipSlots[0x00];
+	ClipDirect = OPN_CHIPS == 1 && First.Audio.Resampler == 0x02 && First.Queue == nullptr && First.Mix.Unity && BusSafe;
+}
+
+// Resamples all chips into the bus. Chips at unity gain go straight in as long as the bus can't overflow,
+// the others are resampled into a run of their own and added with saturation.
+static void MixChips(WAVE_32BS *Bus, uint32_t Length){
+	WAVE_32BS *ChipBuf = Scratch->Chip.data();
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		const ChipMix &Mix = ChipSlots[CurChip].Mix;
+		if(Mix.Unity && BusSafe){
+			ResampleChipStream(CurChip, Bus, Length);
+			continue;
+		}
+		std::fill_n(ChipBuf, Length, WAVE_32BS{});
+		ResampleChipStream(CurChip, ChipBuf, Length);    // muted chips still have to keep up
+		if(Mix.Left != 0.0f || Mix.Right != 0.0f){
+			MixKernels.MixRun(Bus, ChipBuf, Length, Mix);
+		}
+	}
+}
+
+// Frames from the current one on that can be rendered in one go: up to the next DAC write, tick or replayed event,
+// and no more than the chip samples the resamplers can take at once
+static uint32_t RunLength(uint32_t Remaining){
+	uint32_t Length = std::min(Remaining, SMPL_BUFSIZE);
+	if(TickCallback != nullptr){
+		Length = TickPeriod && NextTick > StreamCursor ? static_cast<uint32_t>(std::min<uint64_t>(Length, NextTick - StreamCursor)) : 1;
+	}
+	if(ReplayNext != EventEnd){
+		Length = static_cast<uint32_t>(std::min<uint64_t>(Length, EventAt(ReplayNext).Frame - StreamCursor));
+	}
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		const DACState *TempDAC = &ChipSlots[CurChip].DAC;
+		if(TempDAC->Data != nullptr && TempDAC->Delta){
+			Length = std::min(Length, (0x10000 - TempDAC->SmplFric + TempDAC->Delta - 1) / TempDAC->Delta);
+		}
+		const ChipAudioAttributes &Audio = ChipSlots[CurChip].Audio;
+		if((Audio.Resampler == 0x01 || Audio.Resampler == 0x03) && ChipSlots[CurChip].Queue == nullptr){
+			// the run's chip samples plus the ones kept from before (LSmpl/NSmpl), with room for rounding
+			constexpr uint32_t Room = SMPL_BUFSIZE - 8;
+			Length = std::min({Length, Room, std::max(1u, static_cast<uint32_t>(static_cast<uint64_t>(Room) * SampleRate / Audio.SmpRate))});
+		}
+	}
+	return Length;
+}
+
+static void ReplayEvent(const HistoryEvent &Event);
+
+// Applies the recorded events due at the cursor while playing back after a seek.
+// BeforeTick stops at the ones the tick callback wrote, the tick about to fire writes anew.
+static void ReplayJournal(bool BeforeTick){
+	for(; ReplayNext != EventEnd && EventAt(ReplayNext).Frame <= StreamCursor; ReplayNext++){
+		if(BeforeTick && EventAt(ReplayNext).Tick){
+			break;
+		}
+		ReplayEvent(EventAt(ReplayNext));
+	}
+}
+
+void FillBuffer(WAVE_16BS *Buffer, uint32_t BufferSize){
+	uint8_t CurChip;
+
+	if(Buffer == nullptr){
+		return;
+	}
+
+	OPN_TRACE_SCOPE("FillBuffer", static_cast<int32_t>(BufferSize));
+	uint64_t Start = TimeNs();
+	std::unique_lock lock(writeGuard, std::try_to_lock);
+	bool Contended = !lock.owns_lock();
+	if(Contended){
+		lock.lock();
+	}
+	uint64_t Locked = Contended ? TimeNs() : Start;
+	//EnterCriticalSection(&write_sect);
+
+	if(RealtimePending){
+		ApplyThreadOptions();
+	}
+	if(PrerenderPos != PrerenderEnd && !Prerendering){
+		// rendered while the device started up, not counted again
+		uint32_t Count = std::min(BufferSize, PrerenderEnd - PrerenderPos);
+		std::copy_n(&Scratch->Prerendered[PrerenderPos], Count, Buffer);
+		PrerenderPos += Count;
+		if(PrerenderPos == PrerenderEnd){
+			DropPrerendered();
+		}
+		Buffer += Count;
+		BufferSize -= Count;
+		if(!BufferSize){
+			return;
+		}
+	}
+	if(NullSamples == 0xFFFFFFFF){
+		// the chips stand still and so does the stream position, until a key on resumes them
+		std::fill_n(Buffer, BufferSize, WAVE_16BS{});
+		Statistics.PausedCallbacks.Add(1);
+		return;
+	}
+	ProfileCallback = Statistics.Callbacks.Get() % OPN_STATS_PROFILE_INTERVAL == 0;
+	ProfiledChipNs = 0;
+	uint64_t ResampleNs = 0;
+
+	for(CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		if(ChipSlots[CurChip].Queue != nullptr){
+			AdjustQueueRate(ChipSlots[CurChip].Queue, BufferSize);
+		}
+	}
+	LoadChipMix();
+	WAVE_32BS *TempBuf = Scratch->Bus.data();
+	for(uint32_t CurSmpl = 0x00; CurSmpl < BufferSize;){
+		if(TickCallback != nullptr && TickDue()){
+			// the callback writes through the public functions, which take the lock themselves.
+			// After a seek back the recording only plays up to here, the sequencer takes over.
+			OPN_TRACE_SCOPE("Tick");
+			ReplayJournal(true);
+			TrimHistory();
+			lock.unlock();
+			InTick = true;
+			TickCallback(TickUser, StreamCursor);
+			InTick = false;
+			lock.lock();
+			LoadChipMix();    // the callback may have changed the mix
+		}
+		ReplayJournal(false);
+		for(CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+			UpdateDAC(CurChip, 1);
+		}
+		uint32_t Length = RunLength(BufferSize - CurSmpl);
+		uint64_t ResampleStart = ProfileCallback ? TimeNs() : 0;
+		if(ClipDirect){
+			CopyChipStream(0x00, Length);
+		}else{
+			std::fill_n(TempBuf, Length, WAVE_32BS{});
+			MixChips(TempBuf, Length);
+		}
+		if(ProfileCallback){
+			ResampleNs += TimeNs() - ResampleStart;
+		}
+		if(Length > 1){
+			for(CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+				UpdateDAC(CurChip, Length - 1);    // the rest of the run, RunLength made sure there's no write in it
+			}
+		}
+
+		bool Loud = ClipDirect ? MixKernels.ClipPlanar(&Buffer[CurSmpl], StreamBufs[0x00], StreamBufs[0x01], Length, ChipSlots[0x00].Audio.Volume)
+		                       : MixKernels.ClipRun(&Buffer[CurSmpl], TempBuf, Length);
+		NullSamples = Loud ? 0 : std::min(NullSamples, 0xFFFFFFFE - Length) + Length;    // 0xFFFFFFFF is paused
+		CurSmpl += Length;
+		StreamCursor += Length;    // per run, so writes from the tick callback get recorded at the frame they hit
+	}
+
+	// after IdlePauseMs of silence, or right away once the output is quiet and nothing can make a sound anymore
+	if(IdlePauseMs && (static_cast<uint64_t>(NullSamples) * 1000 >= static_cast<uint64_t>(IdlePauseMs) * SampleRate
+	                   || (NullSamples && ChipsIdle()))){
+		if(Offline || TickCallback != nullptr || TimerRunning() || Replaying()){
+			NullSamples = 0;    // timers, ticks and the recording only advance while rendering, keep going
+		}else{
+			PauseOutput();    // stop the stream if chip isn't used
+		}
+	}
+
+	if(KeyframeInterval && !Replaying()){
+		HistoryEnd = StreamCursor;
+		if(StreamCursor >= KeyAt(KeyEnd - 1).Frame + static_cast<uint64_t>(KeyframeInterval) * SampleRate){
+			CaptureKeyframe();
+		}
+	}
+
+	uint64_t End = TimeNs();
+	uint64_t Duration = End - Start;
+	Statistics.Callbacks.Add(1);
+	Statistics.Frames.Add(BufferSize);
+	Statistics.CallbackNs.Add(Duration);
+	Statistics.CallbackMaxNs.Max(Duration);
+	Statistics.CallbackMaxFrames.Max(BufferSize);
+	Statistics.CallbackHistogram[std::min<size_t>(std::bit_width(Duration / 1000), OPN_STATS_HISTOGRAM_BUCKETS - 1)].Add(1);
+	if(Contended){
+		Statistics.LockContentions.Add(1);
+		Statistics.LockWaitNs.Add(Locked - Start);
+	}
+	if(SampleRate && Duration * SampleRate > BufferSize * 1000000000ull){
+		Statistics.Underruns.Add(1);    // the device played the buffer faster than it was rendered
+	}
+	if(ProfileCallback){
+		Statistics.ProfiledCallbacks.Add(1);
+		Statistics.ProfiledChipNs.Add(ProfiledChipNs);
+		Statistics.ProfiledResampleNs.Add(ResampleNs - ProfiledChipNs);
+		Statistics.ProfiledMixNs.Add(End - Locked - ResampleNs);
+		ProfileCallback = false;
+	}
+	//LeaveCriticalSection(&write_sect);
+}
+
+void PrerenderBuffer(uint32_t Frames){
+	std::unique_lock lock(writeGuard);
+	if(Scratch == nullptr || NullSamples == 0xFFFFFFFF || PrerenderEnd){
+		return;    // closed, paused again or still holding output
+	}
+	Frames = std::min(Frames, PRERENDER_SIZE);
+	Prerendering = true;
+	lock.unlock();
+	FillBuffer(Scratch->Prerendered.data(), Frames);    // the backend doesn't close the driver while it waits for this
+	lock.lock();
+	Prerendering = false;
+	PrerenderEnd = Frames;
+}
+
+// Same as FillBuffer without producing any output, used to catch up after restoring a keyframe.
+// DAC writes have to hit the chip at the same samples as during playback, so chips with an active DAC
+// are skipped from one DAC write to the next.
+static void SkipBuffer(uint32_t BufferSize){
+	OPN_TRACE_SCOPE("SkipBuffer", static_cast<int32_t>(BufferSize));
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		DACState *TempDAC = &ChipSlots[CurChip].DAC;
+		uint32_t TailSize = std::min(BufferSize, SkipTailLength(&ChipSlots[CurChip].Audio));
+		uint32_t Remaining = BufferSize - TailSize;
+
+		while(Remaining){
+			if(TempDAC->Data == nullptr || !TempDAC->Delta){
+				SkipChipStream(CurChip, Remaining);
+				break;
+			}
+
+			// UpdateDAC writes on the sample where SmplFric crosses 0x10000
+			uint32_t UntilWrite = (0x10000 - TempDAC->SmplFric + TempDAC->Delta - 1) / TempDAC->Delta;
+			if(UntilWrite > Remaining){
+				UpdateDAC(CurChip, Remaining);
+				SkipChipStream(CurChip, Remaining);
+				break;
+			}
+			SkipChipStream(CurChip, UntilWrite - 1);
+			UpdateDAC(CurChip, UntilWrite);
+			SkipChipStream(CurChip, 1);
+			Remaining -= UntilWrite;
+		}
+
+		for(uint32_t CurSmpl = 0x00; CurSmpl < TailSize; CurSmpl++){
+			WAVE_32BS TempBuf{};
+			UpdateDAC(CurChip, 1);
+			ResampleChipStream(CurChip, &TempBuf, 1);
+		}
+	}
+	StreamCursor += BufferSize;
+}
+
+uint8_t SeekStream(uint64_t Frame){
+	OPN_TRACE_SCOPE("Seek");
+	const std::lock_guard lock(writeGuard);
+	if(!OPN_CHIPS || !KeyframeInterval || Frame < KeyAt(KeyFirst).Frame || Frame > HistoryEnd){
+		return 0xFF;
+	}
+
+	// nearest keyframe at or before the target, the oldest one is at or before it
+	uint64_t KeyPos = KeyEnd - 1;
+	while(KeyAt(KeyPos).Frame > Frame){
+		KeyPos--;
+	}
+	const Keyframe &Key = KeyAt(KeyPos);
+	const KeyframeChip *Chips = KeyChips(KeyPos);
+	for(uint8_t CurChip = 0x00; CurChip < OPN_CHIPS; CurChip++){
+		RestoreChipState(CurChip, Chips[CurChip].State);
+		ChipSlots[CurChip].DAC.Data = Chips[CurChip].DACData;
+		SetChipMute(CurChip, Chips[CurChip].MuteMask);
+	}
+	StreamCursor = Key.Frame;
+	DropPrerendered();
+
+	// fast-forward to the target, replaying whatever the host did on the way; playback replays the rest
+	for(ReplayNext = Key.Event; ReplayNext != EventEnd && EventAt(ReplayNext).Frame < Frame; ReplayNext++){
+		SkipBuffer(static_cast<uint32_t>(EventAt(ReplayNext).Frame - StreamCursor));
+		ReplayEvent(EventAt(ReplayNext));
+	}
+	SkipBuffer(static_cast<uint32_t>(Frame - StreamCursor));
+
+	// silence isn't tracked while skipping, so the stream only stays paused when landing right on a keyframe
+	if(Frame == Key.Frame && Key.NullSamples == 0xFFFFFFFF && !Replaying()){
+		PauseOutput();
+	}else{
+		ResumeOutput();
+		NullSamples = Frame == Key.Frame && Key.NullSamples != 0xFFFFFFFF ? Key.NullSamples : 0;
+	}
+	ScheduleTick();
+	return 0x00;
+}
+
+uint64_t GetStreamCursor(){
+	const std::lock_guard lock(writeGuard);
+	return StreamCursor - (PrerenderEnd - PrerenderPos);    // what's rendered ahead hasn't been played yet
+}
+
+uint64_t GetStreamLength(){
+	const std::lock_guard lock(writeGuard);
+	return KeyframeInterval ? HistoryEnd : 0;
+}
+
+static void StartDAC(uint8_t ChipID, std::span<uint8_t const> Data, uint32_t SmplFreq){
+	DACState *TempDAC = &ChipSlots[ChipID].DAC;
+	TempDAC->DataSize = Data.size();
+	TempDAC->Data = Data.data();
+	if(SmplFreq){
+		TempDAC->Frequency = SmplFreq;
+	}
+	TempDAC->Delta = MulDivRoundU(0x10000, TempDAC->Frequency, SampleRate);
+	TempDAC->SmplPos = 0x00;
+}
+
+static void SetDACDelta(uint8_t ChipID, uint32_t SmplFreq){
+	DACState *TempDAC = &ChipSlots[ChipID].DAC;
+	TempDAC->Frequency = SmplFreq;
+	TempDAC->Delta = MulDivRoundU(0x10000, TempDAC->Frequency, SampleRate);
+}
+
+static void ReplayEvent(const HistoryEvent &Event){
+	switch(Event.Type){
+		case HistoryEventType::Write:
+			WriteChip(Event.ChipID, Event.Register, Event.Value & 0xFF, static_cast<bool>(Event.Value & 0x100));
+			break;
+		case HistoryEventType::DACPlay:
+			StartDAC(Event.ChipID, Event.Sample, Event.Value);
+			break;
+		case HistoryEventType::DACFrequency:
+			SetDACDelta(Event.ChipID, Event.Value);
+			break;
+		case HistoryEventType::DACVolume:
+			ChipSlots[Event.ChipID].DAC.Volume = Event.Register;
+			break;
+		case HistoryEventType::Mute:
+			SetChipMute(Event.ChipID, static_cast<uint8_t>(Event.Value));
+			break;
+	}
+}
+
+void PlayDACSample(uint8_t ChipID, size_t DataSize, const uint8_t *Data, uint32_t SmplFreq){
+	PlayDACSample(ChipID, {Data, DataSize}, SmplFreq);
+}
+
+void PlayDACSample(uint8_t ChipID, std::span<uint8_t const> Data, uint32_t SmplFreq){
+	if(ChipID >= OPN_CHIPS){
+		return;
+	}
+
+	const std::lock_guard lock(writeGuard);
+	//EnterCriticalSection(&write_sect);
+
+	if(KeyframeInterval){
+		Data = InternSample(Data);
+	}
+	RecordEvent({StreamCursor, HistoryEventType::DACPlay, ChipID, 0x00, SmplFreq, Data, false});
+	StartDAC(ChipID, Data, SmplFreq);
+
+	ResumeOutput();
+	//LeaveCriticalSection(&write_sect);
+}
+
+void SetDACFrequency(uint8_t ChipID, uint32_t SmplFreq){
+	if(ChipID >= OPN_CHIPS){
+		return;
+	}
+
+	const std::lock_guard lock(writeGuard);
+	RecordEvent({StreamCursor, HistoryEventType::DACFrequency, ChipID, 0x00, SmplFreq, {}, false});
+	SetDACDelta(ChipID, SmplFreq);
+}
+
+void OPN_SetChipMix(uint8_t ChipID, uint16_t Gain, int8_t Pan){
+	if(ChipID >= OPN_CHIPS){
+		return;
+	}
+
+	Gain = std::min(Gain, MIX_MAX_GAIN);
+	Pan = std::max<int8_t>(Pan, -127);
+	MixSettings[ChipID].store(static_cast<uint32_t>(Gain) << 8 | static_cast<uint8_t>(Pan), std::memory_order_relaxed);
+}
+
+void SetDACVolume(uint8_t ChipID, uint16_t Volume){
+	if(ChipID >= OPN_CHIPS){
+		return;
+	}
+
+	const std::lock_guard lock(writeGuard);
+	RecordEvent({StreamCursor, HistoryEventType::DACVolume, ChipID, Volume, 0x00, {}, false});
+	ChipSlots[ChipID].DAC.Volume = Volume;
+}
+
+size_t GetMaxChipsSupported(){
+	return CHIP_LIMIT;
+}
+
+void OPN_SetCPUFeatureLevel(CPUFeatureLevel Level){
+	const std::lock_guard lock(writeGuard);
+	RequestedCPULevel = Level;
+	if(OPN_CHIPS){
+		SelectCPUFeatureLevel();
+	}
+}
+
+CPUFeatureLevel OPN_GetCPUFeatureLevel(){
+	return static_cast<CPUFeatureLevel>(ym2612_get_isa());
+}
+
+size_t OPN_GetStateSize(){
+	return sizeof(OPN_STATE);
+}
+
+StateReturnCode OPN_SaveState(uint8_t ChipID, void *Buffer, size_t BufferSize){
+	using enum StateReturnCode;
+	if(Buffer == nullptr || BufferSize < sizeof(OPN_STATE)){
+		return BufferTooSmall;
+	}
+
+	OPN_STATE State;
+	{
+		const std::lock_guard lock(writeGuard);
+		if(ChipID >= OPN_CHIPS){
+			return InvalidChip;
+		}
+		SaveChipState(ChipID, State);
+	}
+
+	std::memcpy(Buffer, &State, sizeof(OPN_STATE));    // Buffer may not be aligned
+	return Success;
+}
+
+// Resampler counters the way ResampleChipStream and SkipChipStream leave them, anything else could make
+// the next call render more chip samples than the scratch buffers hold
+static bool ResamplerStateValid(const ChipAudioAttributes &Audio){
+	constexpr int32_t SampleLimit = INT32_MAX / 0x100;    // still fits after the volume
+	for(const WAVE_32BS &Smpl : {Audio.LSmpl, Audio.NSmpl}){
+		if(Smpl.Left < -SampleLimit || Smpl.Left > SampleLimit || Smpl.Right < -SampleLimit || Smpl.Right > SampleLimit){
+			return false;
+		}
+	}
+	if(Audio.Resampler == 0xFF){
+		return true;    // no chip rate, nothing is ever rendered
+	}
+	if(Audio.SmpLast >= Audio.SmpRate || Audio.SmpP > SampleRate + SMPL_BUFSIZE){
+		return false;
+	}
+
+	uint32_t Ahead = fp2i_ceil(static_cast<SLINT>(FIXPNT_FACT * static_cast<uint64_t>(Audio.SmpP) * Audio.SmpRate / SampleRate));
+	switch(Audio.Resampler){
+		case 0x01:
+			return Audio.SmpLast <= Audio.SmpNext && Audio.SmpNext <= Audio.SmpLast + 1
+			       && Ahead >= Audio.SmpNext && Ahead - Audio.SmpNext <= 1;
+		case 0x02:
+			return Audio.SmpLast == Audio.SmpNext && Audio.SmpNext <= Audio.SmpP;
+		case 0x03:
+			return Audio.SmpLast == Audio.SmpNext && Audio.SmpNext == Ahead;
+		default:
+			return false;
+	}
+}
+
+static bool DACStateValid(const OPN_DAC_STATE &DAC){
+	return !DAC.DataSize || (DAC.SmplPos < DAC.DataSize && DAC.SmplFric < 0x10000);
+}
+
+StateReturnCode OPN_LoadState(uint8_t ChipID, const void *Buffer, size_t BufferSize){
+	using enum StateReturnCode;
+	if(Buffer == nullptr || BufferSize < sizeof(OPN_STATE)){
+		return BufferTooSmall;
+	}
+
+	OPN_STATE State;
+	std::memcpy(&State, Buffer, sizeof(OPN_STATE));    // Buffer may not be aligned
+	if(State.Magic != OPN_STATE_MAGIC || State.Version != OPN_STATE_VERSION || State.Size != sizeof(OPN_STATE)){
+		return BadState;
+	}
+
+	const std::lock_guard lock(writeGuard);
+	if(ChipID >= OPN_CHIPS){
+		return InvalidChip;
+	}
+	const ChipAudioAttributes &Audio = ChipSlots[ChipID].Audio;
+	if(State.OutputRate != SampleRate || State.Chip.clock != YM2612_CLOCK || State.Chip.rate != Audio.SmpRate
+	   || State.Audio.SmpRate != Audio.SmpRate || State.Audio.Resampler != Audio.Resampler){
+		return ClockMismatch;
+	}
+	if(State.Audio.Volume != Audio.Volume || !ResamplerStateValid(State.Audio) || !DACStateValid(State.DAC)){
+		return BadState;
+	}
+	if(!RestoreChipState(ChipID, State)){
+		return BadState;    // the chip's part is out of range
+	}
+
+	ResetHistory();    // the recording led somewhere else
+	DropPrerendered();
+	return Success;
+}
+
+StateReturnCode OPN_ResumeDACSample(uint8_t ChipID, const uint8_t *Data, size_t DataSize){
+	using enum StateReturnCode;
+	const std::lock_guard lock(writeGuard);
+	if(ChipID >= OPN_CHIPS){
+		return InvalidChip;
+	}
+	DACState *TempDAC = &ChipSlots[ChipID].DAC;
+	if(Data == nullptr || TempDAC->Data != nullptr || TempDAC->SmplPos >= TempDAC->DataSize || DataSize != TempDAC->DataSize){
+		return BadState;    // nothing left to resume, or not the sample the snapshot was playing
+	}
+
+	TempDAC->Data = Data;
+	ResetHistory();    // the keyframe it restarts with takes its own copy of the sample
+	ResumeOutput();
+	return Success;
+}
+
+void OPN_SetDeviceOptions(const OPN_DEVICE_OPTIONS *Options){
+	if(Options == nullptr){
+		DeviceOptions = {};
+		return;
+	}
+	DeviceOptions = {Options->PeriodFrames, Options->Periods, Options->Conservative != 0, Options->Exclusive != 0};
+}
+
+bool OPN_GetDeviceInfo(OPN_DEVICE_INFO *Info){
+	STREAM_INFO Stream;
+	if(Info == nullptr || !OPN_CHIPS || Offline || !GetStreamInfo(Stream)){
+		return false;
+	}
+
+	Info->DeviceRate = Stream.DeviceRate;
+	Info->PeriodFrames = Stream.PeriodFrames;
+	Info->Periods = Stream.Periods;
+	Info->LatencyUs = Stream.DeviceRate ? MulDivRoundU(static_cast<uint64_t>(Stream.PeriodFrames) * Stream.Periods, 1000000, Stream.DeviceRate) : 0;
+	Info->Exclusive = Stream.Exclusive;
+	return true;
+}
+
+void OPN_SetRealtimeOptions(const OPN_REALTIME_OPTIONS *Options){
+	const std::lock_guard lock(writeGuard);
+	RealtimeOptions = Options != nullptr ? *Options : OPN_REALTIME_OPTIONS{};
+	RealtimeApplied.store(0, std::memory_order_relaxed);
+	RealtimeDenied.store(0, std::memory_order_relaxed);
+	RealtimePending = true;
+	ApplyMemoryLock();
+}
+
+void OPN_GetRealtimeStatus(OPN_REALTIME_STATUS *Status){
+	if(Status == nullptr){
+		return;
+	}
+	*Status = {RealtimeApplied.load(std::memory_order_relaxed), RealtimeDenied.load(std::memory_order_relaxed)};
+}
+
+void OPN_SetIdleTimeouts(uint32_t PauseMs, uint32_t SuspendMs){
+	const std::lock_guard lock(writeGuard);
+	IdlePauseMs = PauseMs;
+	IdleSuspendMs = SuspendMs;
+	if(NullSamples == 0xFFFFFFFF && OPN_CHIPS){
+		PauseOutput();    // already paused, restarts the wait for the device
+	}
+}
+
+void OPN_SetTickCallback(OPN_TICK_CALLBACK Callback, void *User, uint32_t Period){
+	const std::lock_guard lock(writeGuard);
+	TickCallback = Callback;
+	TickUser = User;
+	TickPeriod = Period;
+	TickOrigin = StreamCursor;    // first periodic tick right on the next frame
+	ScheduleTick();
+	if(TickCallback != nullptr && OPN_CHIPS){
+		ResumeOutput();
+	}
+}
+
+void OPN_SetKeyframeInterval(uint32_t Seconds){
+	const std::lock_guard lock(writeGuard);
+	KeyframeInterval = Seconds;
+
+	ResetHistory();    // the history restarts at the current position
+}
+
+StateReturnCode OPN_Seek(uint64_t Frame){
+	return SeekStream(Frame) ? StateReturnCode::OutOfRange : StateReturnCode::Success;
+}
+
+uint64_t OPN_GetPosition(){
+	return GetStreamCursor();
+}
+
+uint64_t OPN_GetLength(){
+	return GetStreamLength();
+}
+
+void OPN_GetStats(OPN_STATS *Stats){
+	if(Stats == nullptr){
+		return;
+	}
+
+	OPN_STATS Result{};
+	Result.Callbacks = Statistics.Callbacks.Get();
+	Result.Frames = Statistics.Frames.Get();
+	Result.Writes = Statistics.Writes.Get();
+	Result.Underruns = Statistics.Underruns.Get();
+	Result.LockContentions = Statistics.LockContentions.Get();
+	Result.LockWaitNs = Statistics.LockWaitNs.Get();
+	Result.CallbackNs = Statistics.CallbackNs.Get();
+	Result.CallbackMaxNs = Statistics.CallbackMaxNs.Get();
+	Result.CallbackMaxFrames = static_cast<uint32_t>(Statistics.CallbackMaxFrames.Get());
+	for(size_t Bucket = 0; Bucket < OPN_STATS_HISTOGRAM_BUCKETS; Bucket++){
+		Result.CallbackHistogram[Bucket] = Statistics.CallbackHistogram[Bucket].Get();
+	}
+	Result.ProfiledCallbacks = Statistics.ProfiledCallbacks.Get();
+	Result.ProfiledChipNs = Statistics.ProfiledChipNs.Get();
+	Result.ProfiledResampleNs = Statistics.ProfiledResampleNs.Get();
+	Result.ProfiledMixNs = Statistics.ProfiledMixNs.Get();
+	Result.PausedCallbacks = Statistics.PausedCallbacks.Get();
+	*Stats = Result;
+}
+
+StateReturnCode OPN_GetChipStats(uint8_t ChipID, OPN_CHIP_STATS *Stats){
+	if(ChipID >= OPN_CHIPS){
+		return StateReturnCode::InvalidChip;
+	}
+	if(Stats == nullptr){
+		return StateReturnCode::BufferTooSmall;
+	}
+
+	const ChipStats &Chip = ChipCounters[ChipID];
+	*Stats = {Chip.Samples.Get(), Chip.SkippedSamples.Get(), Chip.Writes.Get(),
+	          Chip.QueueMaxSamples.Get(), Chip.QueueOverruns.Get(), Chip.QueueUnderruns.Get()};
+	return StateReturnCode::Success;
+}
+
+void OPN_ResetStats(){
+	const std::lock_guard lock(writeGuard);
+	ResetStats();
+}
+
+bool OPN_DumpTrace(const char *FileName){
+#ifdef OPN_TRACE
+	return FileName != nullptr && Trace::Dump(FileName);
+#else
+	static_cast<void>(FileName);
+	return false;
+#endif
+}
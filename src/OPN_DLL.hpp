@@ -14,6 +14,8 @@
 	#endif
 #endif
 
+// Number of chips OpenOPNDriver opens when called without an argument, any other count up to
+// GetMaxChipsSupported() can be requested at runtime
 #ifndef MAX_CHIPS
 	#pragma message("Using default value of '0x10' for MAX_CHIPS.\nConsider manually defining a value")
 	#define MAX_CHIPS 0x10
@@ -21,7 +23,7 @@
 
 // default Sample Rate: 48000 Hz
 #ifdef __cplusplus
-static_assert(MAX_CHIPS > 1, "MAX_CHIPS must be able to support at least 1 chip");
+static_assert(MAX_CHIPS > 1 && MAX_CHIPS <= 0xFF, "MAX_CHIPS must be greater than 1 and at most 0xFF");
 
 #define DEFAULT_ARGS(...) = __VA_ARGS__
 #include <cstdint>
@@ -35,6 +37,25 @@ enum class DriverReturnCode : uint8_t {
 
 };
 
+// Return codes for OPN_SaveState/OPN_LoadState/OPN_Seek/OPN_GetChipStats
+enum class StateReturnCode : uint8_t {
+	Success = 0,
+	InvalidChip = 0x80,
+	BufferTooSmall = 0x81,
+	BadState = 0x82,     // wrong magic, version or size, or values out of range
+	ClockMismatch = 0x83,// state was saved from a chip running at a different clock/rate
+	OutOfRange = 0x84,   // seek target outside of the recorded history
+};
+
+// SIMD code paths, see OPN_SetCPUFeatureLevel
+enum class CPUFeatureLevel : uint8_t {
+	Auto = 0,
+	Scalar = 1,
+	SSE41 = 2,
+	AVX2 = 3,
+	AVX512 = 4,
+};
+
 #else
 #define DEFAULT_ARGS(...)
 #include <stdint.h>
@@ -46,21 +67,199 @@ enum DriverReturnCode : uint8_t {
 	DriverReturnCode_SoundDeviceError = 0xC0,
 
 };
+
+// Return codes for OPN_SaveState/OPN_LoadState/OPN_Seek/OPN_GetChipStats
+enum StateReturnCode : uint8_t {
+	StateReturnCode_Success = 0,
+	StateReturnCode_InvalidChip = 0x80,
+	StateReturnCode_BufferTooSmall = 0x81,
+	StateReturnCode_BadState = 0x82,
+	StateReturnCode_ClockMismatch = 0x83,
+	StateReturnCode_OutOfRange = 0x84,
+};
+
+// SIMD code paths, see OPN_SetCPUFeatureLevel
+enum CPUFeatureLevel : uint8_t {
+	CPUFeatureLevel_Auto = 0,
+	CPUFeatureLevel_Scalar = 1,
+	CPUFeatureLevel_SSE41 = 2,
+	CPUFeatureLevel_AVX2 = 3,
+	CPUFeatureLevel_AVX512 = 4,
+};
 #endif
 
+// Sound device setup, see OPN_SetDeviceOptions. Zero everywhere is the default.
+struct OPN_DEVICE_OPTIONS {
+	uint32_t PeriodFrames;    // frames per device callback, 0 = the backend's choice
+	uint32_t Periods;         // periods in the device buffer, 0 = the backend's choice
+	uint8_t Conservative;     // 1 = bigger periods and fewer wakeups, 0 = low latency
+	uint8_t Exclusive;        // 1 = exclusive mode if the device allows it, shared otherwise
+};
+
+// What the device actually runs with, see OPN_GetDeviceInfo
+struct OPN_DEVICE_INFO {
+	uint32_t DeviceRate;      // the device's own rate, the output gets converted to it if it differs
+	uint32_t PeriodFrames;    // at DeviceRate
+	uint32_t Periods;
+	uint32_t LatencyUs;       // the whole device buffer
+	uint8_t Exclusive;
+};
+
+// Scheduling of the rendering thread, see OPN_SetRealtimeOptions
+#define OPN_SCHED_DEFAULT 0    // leave it as it is
+#define OPN_SCHED_FIFO 1       // SCHED_FIFO at Priority 1-99 (Windows: time critical)
+#define OPN_SCHED_RR 2         // SCHED_RR at Priority 1-99 (Windows: time critical)
+#define OPN_SCHED_NICE 3       // normal scheduling at nice level Priority, -20-19 (Windows: mapped to thread priorities)
+
+struct OPN_REALTIME_OPTIONS {
+	uint8_t Policy;          // OPN_SCHED_*
+	int8_t Priority;
+	uint8_t LockMemory;      // 1 = keep the chips and buffers in RAM (mlock), so rendering never page faults
+	uint64_t CPUMask;        // cores the rendering thread may run on, bit n = core n, 0 = any
+};
+
+// OPN_REALTIME_STATUS bits
+#define OPN_RT_SCHEDULING 0x01
+#define OPN_RT_AFFINITY 0x02
+#define OPN_RT_MEMLOCK 0x04
+
+struct OPN_REALTIME_STATUS {
+	uint8_t Applied;         // OPN_RT_* that took effect
+	uint8_t Denied;          // OPN_RT_* the OS refused: missing privileges, RLIMIT_RTPRIO, RLIMIT_MEMLOCK, ...
+};
+
+// Counters since OpenOPNDriver/OPN_ResetStats, see OPN_GetStats
+#define OPN_STATS_HISTOGRAM_BUCKETS 16
+#define OPN_STATS_PROFILE_INTERVAL 16    // every n-th callback is split into chip/resampling/mixing time
+
+struct OPN_STATS {
+	uint64_t Callbacks;            // buffers rendered for the sound device
+	uint64_t Frames;               // output frames in them
+	uint64_t Writes;               // register writes applied, all chips
+	uint64_t Underruns;            // callbacks that took longer than the audio they rendered
+	uint64_t LockContentions;      // callbacks that had to wait for a writer
+	uint64_t LockWaitNs;
+	uint64_t CallbackNs;           // total time spent rendering, including the lock wait
+	uint64_t CallbackMaxNs;
+	uint32_t CallbackMaxFrames;    // largest buffer requested by the device
+	uint32_t Reserved;
+	// callback durations: bucket 0 is < 1 us, bucket n is [2^(n-1), 2^n) us, the last one takes everything above
+	uint64_t CallbackHistogram[OPN_STATS_HISTOGRAM_BUCKETS];
+	// where the time goes, measured on every OPN_STATS_PROFILE_INTERVAL-th callback only
+	uint64_t ProfiledCallbacks;
+	uint64_t ProfiledChipNs;       // YM2612 rendering
+	uint64_t ProfiledResampleNs;   // resampling, without the chip rendering
+	uint64_t ProfiledMixNs;        // DAC streaming, mixing and clipping
+	uint64_t PausedCallbacks;      // buffers answered with plain silence while idle, not in Callbacks
+};
+
+struct OPN_CHIP_STATS {
+	uint64_t Samples;              // samples rendered at the chip rate
+	uint64_t SkippedSamples;       // samples fast-forwarded without output (seeking)
+	uint64_t Writes;               // register writes applied
+	// chips run by OPN_RunCycles only
+	uint64_t QueueMaxSamples;      // most samples waiting for the sound device at once
+	uint64_t QueueOverruns;        // samples dropped because the host ran too far ahead
+	uint64_t QueueUnderruns;       // samples the sound device needed before the host rendered them
+};
+
+// SetOPNOptions rate for output at the chip's own rate (clock / 144, 53267 Hz): no resampling at all, the cheapest
+// to render. The device has to accept that rate, or converts it itself.
+#define OPN_CHIP_RATE 0xFFFFFFFF
+
 extern "C" {
-EXPORTED void SetOPNOptions(uint32_t SmplRate DEFAULT_ARGS(0));
+EXPORTED void SetOPNOptions(uint32_t SmplRate DEFAULT_ARGS(0));    // 0 = the device's native rate
 EXPORTED DriverReturnCode OpenOPNDriver(uint8_t Chips DEFAULT_ARGS(MAX_CHIPS));
 EXPORTED void CloseOPNDriver();
 
+// Trades wakeups (CPU) against latency, applies from the next OpenOPNDriver on. nullptr restores the defaults.
+EXPORTED void OPN_SetDeviceOptions(const OPN_DEVICE_OPTIONS *Options);
+EXPORTED bool OPN_GetDeviceInfo(OPN_DEVICE_INFO *Info);    // false if no sound device is open
+// Idle handling: after PauseMs of silence the chips stop rendering and the device only gets silence, after SuspendMs
+// more the device is stopped as well, so it doesn't wake the CPU anymore. Key on, timer start or DAC output resumes
+// both. 0 disables the respective step, the defaults are 1000 and 5000 ms. Timers and tick callbacks never pause.
+EXPORTED void OPN_SetIdleTimeouts(uint32_t PauseMs, uint32_t SuspendMs);
+
+// Keeps the rendering thread (the sound device's callback, or the caller of OPN_Render) from being preempted or
+// page faulting. The thread settings are applied by that thread on its next render, which also pre-faults its stack;
+// memory is locked right away and from then on whenever the driver is opened. nullptr resets to the defaults.
+// Note: what was set before stays in place for that thread, the defaults only stop further changes
+EXPORTED void OPN_SetRealtimeOptions(const OPN_REALTIME_OPTIONS *Options);
+EXPORTED void OPN_GetRealtimeStatus(OPN_REALTIME_STATUS *Status);
+
+// Offline rendering (e.g. to a file): opened without a sound device, the host pulls the output with OPN_Render
+// (interleaved 16 bit stereo) instead. Rate 0 renders at the chip rate here. CloseOPNDriver closes it as usual.
+EXPORTED DriverReturnCode OPN_OpenOffline(uint8_t Chips DEFAULT_ARGS(MAX_CHIPS));
+EXPORTED void OPN_Render(int16_t *Buffer, uint32_t Frames);
+
 EXPORTED void OPN_Write(uint8_t ChipID, uint16_t Register, uint8_t Data);
+// Status register: bit 0 = Timer A, bit 1 = Timer B overflowed, cleared by writing bits 4/5 of register 0x27.
+// The timers count the rendered output, so they run at the pace of the sound device and keep it from pausing.
+EXPORTED uint8_t OPN_ReadStatus(uint8_t ChipID);
+
+// Emulator integration: instead of following the sound device, the chip is run by the host in master clock cycles
+// (YM2612 clock, 144 per sample) elapsed since its previous call. The samples they complete are rendered right away
+// and queued for the sound device, OPN_WriteAtCycle runs the chip first, so the write lands on the host's cycle.
+// The first call switches the chip to this mode until the driver is closed, it isn't covered by seeking.
+EXPORTED void OPN_RunCycles(uint8_t ChipID, uint32_t Cycles);
+EXPORTED void OPN_WriteAtCycle(uint8_t ChipID, uint32_t Cycles, uint16_t Register, uint8_t Data);
+// Those chips are resampled at a slightly adjusted rate that keeps about Samples (chip rate) queued, so the two clocks
+// can't drift apart. Lower is less latency, but has to cover the time between the host's calls (default 2048, ~40 ms).
+EXPORTED void OPN_SetQueueLatency(uint32_t Samples);
 EXPORTED void OPN_Mute(uint8_t ChipID, uint8_t MuteMask);
 
 EXPORTED void PlayDACSample(uint8_t ChipID, size_t DataSize, const uint8_t *Data, uint32_t SmplFreq);
 EXPORTED void SetDACFrequency(uint8_t ChipID, uint32_t SmplFreq);
 EXPORTED void SetDACVolume(uint8_t ChipID, uint16_t Volume);// 0x100 = 100%
+// Mix bus: gain (0x100 = 100%, up to 0x400) and pan (-127 = left only, 0 = center, 127 = right only) of a chip.
+// Doesn't take the lock, so a mixer can call it at any rate; applies from the next buffer on (from a tick callback,
+// right on the tick's frame), not part of seeking.
+EXPORTED void OPN_SetChipMix(uint8_t ChipID, uint16_t Gain, int8_t Pan);
+
+EXPORTED size_t GetMaxChipsSupported();    // largest chip count OpenOPNDriver accepts
+
+// OpenOPNDriver uses the widest code path the CPU supports for the chips and the mixing, all of them sound the same.
+// Any other Level than Auto forces that path instead (or the widest supported one below it), for testing and comparing.
+// With Auto, the OPN_CPU environment variable (scalar, sse4.1, avx2 or avx512) does the same.
+// Applies immediately if the driver is running.
+EXPORTED void OPN_SetCPUFeatureLevel(CPUFeatureLevel Level);
+EXPORTED CPUFeatureLevel OPN_GetCPUFeatureLevel();    // code path in use
+
+// Chip snapshots: the buffer must hold at least OPN_GetStateSize() bytes. They contain no pointers, so they can be
+// written to a file, and OPN_LoadState rejects anything the chip couldn't have produced.
+// A playing DAC sample is stored as its size and position only: after loading, it stays silent until the host passes
+// the same sample to OPN_ResumeDACSample, which continues it where it was.
+EXPORTED size_t OPN_GetStateSize();
+EXPORTED StateReturnCode OPN_SaveState(uint8_t ChipID, void *Buffer, size_t BufferSize);
+EXPORTED StateReturnCode OPN_LoadState(uint8_t ChipID, const void *Buffer, size_t BufferSize);
+EXPORTED StateReturnCode OPN_ResumeDACSample(uint8_t ChipID, const uint8_t *Data, size_t DataSize);
 
-EXPORTED size_t GetMaxChipsSupported();
+// Seeking: while enabled, all chips are snapshotted every Seconds seconds of output and every write, DAC call and
+// OPN_Mute is recorded, so the stream can be moved to any frame between the oldest snapshot and OPN_GetLength().
+// 0 disables it (default). The last 64 snapshots and 32768 events are kept, older ones are dropped as new ones come in.
+// After a seek back, playing on plays the recording until the host writes again (or a tick callback ticks),
+// which drops what was recorded after that point. OPN_LoadState and OPN_ResumeDACSample restart the recording.
+// DAC samples are copied on their first PlayDACSample, the host's buffers don't have to outlive the call.
+EXPORTED void OPN_SetKeyframeInterval(uint32_t Seconds);
+EXPORTED StateReturnCode OPN_Seek(uint64_t Frame);
+EXPORTED uint64_t OPN_GetPosition();// in output frames
+EXPORTED uint64_t OPN_GetLength();
+
+// Sequencer tick: Callback runs on the audio thread right before the frame it gets passed is rendered, so whatever it
+// writes (OPN_Write, PlayDACSample, ...) takes effect on exactly that frame, in lockstep with the output.
+// Period is in output frames, 0 ticks on every Timer B overflow of chip 0 instead. nullptr removes the callback.
+// Note: the stream doesn't pause while a callback is set, and the callback must not open or close the driver
+typedef void (*OPN_TICK_CALLBACK)(void *User, uint64_t Frame);
+EXPORTED void OPN_SetTickCallback(OPN_TICK_CALLBACK Callback, void *User, uint32_t Period);
+
+// Performance counters, safe to read from any thread at any time without blocking the audio thread
+EXPORTED void OPN_GetStats(OPN_STATS *Stats);
+EXPORTED StateReturnCode OPN_GetChipStats(uint8_t ChipID, OPN_CHIP_STATS *Stats);
+EXPORTED void OPN_ResetStats();
+
+// Writes the events recorded since the last dump as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev)
+// Only available when built with OPN_TRACE, returns false otherwise or if the file can't be written
+EXPORTED bool OPN_DumpTrace(const char *FileName);
 }
 
 #ifdef __cplusplus
@@ -74,7 +273,7 @@ struct WAVE_32BS {
 
 struct ChipAudioAttributes {
 	uint32_t SmpRate;
-	uint16_t Volume;
+	uint16_t Volume;  // fixed point scale of the resampled output, 0x100; gain and pan are applied by the mix bus
 	uint8_t Resampler;// Resampler Type: 00 - Old, 01 - Upsampling, 02 - Copy, 03 - Downsampling
 	uint32_t SmpP;    // Current Sample (Playback Rate)
 	uint32_t SmpLast; // Sample Number Last
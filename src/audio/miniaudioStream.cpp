@@ -2,35 +2,90 @@
 #include "miniaudio.h"
 #include "ym2612DataSource.hpp"
 
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 static ma_device device;
 static std::unique_ptr<YM2612DataSource> chipSource;
 
-uint8_t SoundLogging(bool Mode){
+// miniaudio's device can't be stopped from its own callback, and starting it may run the callback right away,
+// which takes the driver's lock the caller of PauseStream holds. So both are left to this thread.
+static struct {
+	std::thread Thread;
+	std::mutex Mutex;
+	std::condition_variable Wake;
+	bool Paused = false;
+	bool Stopped = false;      // device stopped by the thread
+	bool Quit = true;          // also: no device
+	uint32_t SuspendMs = 0;
+	uint64_t Pauses = 0;       // restarts the wait when pausing again
+} control;
 
+// Stops the device once it's paused for SuspendMs, starts it again on resume
+static void ControlThread(){
+	std::unique_lock lock(control.Mutex);
+	while(!control.Quit){
+		if(control.Paused && !control.Stopped && control.SuspendMs){
+			uint64_t Pause = control.Pauses;
+			if(control.Wake.wait_for(lock, std::chrono::milliseconds(control.SuspendMs),
+			                         [Pause] { return control.Quit || !control.Paused || control.Pauses != Pause; })){
+				continue;
+			}
+			lock.unlock();
+			ma_device_stop(&device);
+			lock.lock();
+			control.Stopped = true;
+		}else if(!control.Paused && control.Stopped){
+			lock.unlock();
+			// the device pulls a whole buffer right away: render it while the device starts up, so the key on
+			// that resumed it plays as soon as the device runs
+			uint64_t Frames = static_cast<uint64_t>(device.playback.internalPeriodSizeInFrames) * device.playback.internalPeriods;
+			PrerenderBuffer(static_cast<uint32_t>(Frames * SampleRate / device.playback.internalSampleRate));
+			ma_device_start(&device);
+			lock.lock();
+			control.Stopped = false;
+		}else{
+			control.Wake.wait(lock);
+		}
+	}
+}
+
+uint8_t SoundLogging([[maybe_unused]] bool Mode){
+	return 0x00;
 }
 
 void data_callback([[maybe_unused]] ma_device *pDevice, void *pOutput, [[maybe_unused]] const void *pInput, ma_uint32 frameCount){
 	// In playback mode copy data to pOutput. In capture mode read data from pInput. In full-duplex mode, both
 	// pOutput and pInput will be valid, and you can move data from pInput into pOutput. Never process more than
 	// frameCount frames.
-	chipSource->read(pOutput, reinterpret_cast<ma_uint64 &>(frameCount));
+	chipSource->read(pOutput, frameCount);
 }
 
-uint8_t StartStream(uint8_t DeviceID){
+uint8_t StartStream(uint8_t DeviceID, const STREAM_OPTIONS &Options){
 	ma_device_config config = ma_device_config_init(ma_device_type_playback);
 	config.playback.format = ma_format_s16;   // Set to ma_format_unknown to use the device's native format.
 	config.playback.channels = 2;               // Set to 0 to use the device's native channel count.
-	config.sampleRate = 0;           // Set to 0 to use the device's native sample rate.
+	config.sampleRate = SampleRate;  // Set to 0 to use the device's native sample rate.
+	config.periodSizeInFrames = Options.PeriodFrames;    // 0 = miniaudio's default for the performance profile
+	config.periods = Options.Periods;
+	config.performanceProfile = Options.Conservative ? ma_performance_profile_conservative : ma_performance_profile_low_latency;
+	config.playback.shareMode = Options.Exclusive ? ma_share_mode_exclusive : ma_share_mode_shared;
 	config.dataCallback = data_callback;   // This function will be called when miniaudio needs more data.
 	//config.pUserData         = pMyCustomData;   // Can be accessed from the device object (device.pUserData).
 
 	auto result = ma_device_init(nullptr, &config, &device);
+	if(result == MA_SHARE_MODE_NOT_SUPPORTED && Options.Exclusive){
+		config.playback.shareMode = ma_share_mode_shared;
+		result = ma_device_init(nullptr, &config, &device);
+	}
 
 	if(result != MA_SUCCESS){
 		return result;  // Failed to initialize the device.
 	}
+	SampleRate = device.sampleRate;
 
 	try {
 		auto* dataSource = new YM2612DataSource;
@@ -43,12 +98,48 @@ uint8_t StartStream(uint8_t DeviceID){
 	if(result != MA_SUCCESS){
 		return result;  // Failed to start the device.
 	}
+	{
+		const std::lock_guard lock(control.Mutex);
+		control.Paused = control.Stopped = control.Quit = false;
+	}
+	control.Thread = std::thread(ControlThread);
+	return MA_SUCCESS;
 }
 
-uint8_t StopStream(bool SkipWOClose){
-	ma_device_uninit(&device);
+bool GetStreamInfo(STREAM_INFO &Info){
+	if(chipSource == nullptr){
+		return false;
+	}
+	Info.DeviceRate = device.playback.internalSampleRate;
+	Info.PeriodFrames = device.playback.internalPeriodSizeInFrames;
+	Info.Periods = device.playback.internalPeriods;
+	Info.Exclusive = device.playback.shareMode == ma_share_mode_exclusive;
+	return true;
 }
 
-void PauseStream(bool PauseOn){
+uint8_t StopStream([[maybe_unused]] bool SkipWOClose){
+	if(control.Thread.joinable()){
+		{
+			const std::lock_guard lock(control.Mutex);
+			control.Quit = true;
+		}
+		control.Wake.notify_one();
+		control.Thread.join();
+	}
+	ma_device_uninit(&device);
+	chipSource.reset();
+	return 0x00;
+}
 
+void PauseStream(bool PauseOn, uint32_t SuspendMs){
+	{
+		const std::lock_guard lock(control.Mutex);
+		if(control.Quit || (!PauseOn && !control.Paused)){
+			return;
+		}
+		control.Paused = PauseOn;
+		control.SuspendMs = SuspendMs;
+		control.Pauses += PauseOn;
+	}
+	control.Wake.notify_one();
 }
\ No newline at end of file
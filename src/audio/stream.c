@@ -8,6 +8,12 @@
 
 #include "stream.hpp"
 
+#define BUFSIZE_MAX 0x1000    // Maximum Buffer Size in Bytes
+#define AUDIOBUFFERS 200      // Maximum Buffer Count
+//	Windows:	BUFFERSIZE = SampleRate / 100 * SAMPLESIZE (44100 / 100 * 4 = 1764)
+//				1 Audio-Buffer = 10 msec, Min: 5
+//				Win95- / WinVista-safe: 500 msec
+
 static DWORD WINAPI WaveOutThread(void *Arg);
 
 static void BufCheck();
@@ -196,7 +202,7 @@ uint8_t StopStream(bool SkipWOClose){
 	return 0x00;
 }
 
-void PauseStream(bool PauseOn){
+void PauseStream(bool PauseOn, uint32_t SuspendMs){    // the thread keeps running, SuspendMs isn't supported
 	if(!WaveOutOpen){
 		return;
 	}   // Thread is not active
@@ -11,18 +11,44 @@ struct WAVE_Sample{
 using WAVE_16BS = WAVE_Sample<int16_t>;
 
 constexpr auto SAMPLESIZE = sizeof(WAVE_16BS);
-constexpr auto BUFSIZE_MAX = 0x1000;    // Maximum Buffer Size in Bytes
-constexpr auto AUDIOBUFFERS = 200;      // Maximum Buffer Count
-//	Windows:	BUFFERSIZE = SampleRate / 100 * SAMPLESIZE (44100 / 100 * 4 = 1764)
-//				1 Audio-Buffer = 10 msec, Min: 5
-//				Win95- / WinVista-safe: 500 msec
+
+// Device setup for StartStream, 0 leaves the choice to the backend
+struct STREAM_OPTIONS {
+	uint32_t PeriodFrames;    // frames per callback
+	uint32_t Periods;         // periods in the device buffer
+	bool Conservative;        // bigger periods for fewer wakeups instead of low latency
+	bool Exclusive;           // exclusive mode, falls back to shared if the device refuses
+};
+
+// What the device actually runs with, PeriodFrames is at the device's own rate
+struct STREAM_INFO {
+	uint32_t DeviceRate;
+	uint32_t PeriodFrames;
+	uint32_t Periods;
+	bool Exclusive;
+};
 
 uint8_t SoundLogging(bool Mode);
 
-uint8_t StartStream(uint8_t DeviceID);
+uint8_t StartStream(uint8_t DeviceID, const STREAM_OPTIONS &Options);
+
+bool GetStreamInfo(STREAM_INFO &Info);    // false if there's no device
 
 uint8_t StopStream(bool SkipWOClose);
 
-void PauseStream(bool PauseOn);
+// While paused FillBuffer only produces silence, after SuspendMs (0 = never) the backend may stop the device.
+// Called with the driver's lock held, also from within FillBuffer, so it must not wait for the device.
+void PauseStream(bool PauseOn, uint32_t SuspendMs);
 
 void FillBuffer(WAVE_16BS *Buffer, uint32_t BufferSize);
+
+// Renders up to Frames ahead, the next FillBuffer calls hand them out first. For backends that restart a stopped
+// device on resume: the output after the key on is ready by the time the device asks for it.
+void PrerenderBuffer(uint32_t Frames);
+
+// Returns 0x00 on success, 0xFF if the frame isn't covered by the seek history
+uint8_t SeekStream(uint64_t Frame);
+
+uint64_t GetStreamCursor();
+
+uint64_t GetStreamLength();    // 0 if unknown
@@ -4,6 +4,8 @@
 
 #include "ym2612DataSource.hpp"
 
+#include <algorithm>
+
 ma_data_source_vtable YM2612DataSource::vtable = {
         YM2612DataSource_read,
         YM2612DataSource_seek,
@@ -12,9 +14,21 @@ ma_data_source_vtable YM2612DataSource::vtable = {
         YM2612DataSource_get_length,
 };
 
-ma_result YM2612DataSource::read(void *pFramesOut, ma_uint64 &frameCount, const ma_uint64 &pFramesRead) {
+ma_result YM2612DataSource::read(void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead) {
 	// Read data here. Output in the same format returned by my_data_source_get_data_format().
+	auto *frames = static_cast<WAVE_16BS *>(pFramesOut);
+	ma_uint64 framesLeft = frameCount;
+	while(framesLeft){
+		auto chunk = static_cast<uint32_t>(std::min<ma_uint64>(framesLeft, UINT32_MAX));
+		FillBuffer(frames, chunk);
+		frames += chunk;
+		framesLeft -= chunk;
+	}
 
+	if(pFramesRead != nullptr){
+		*pFramesRead = frameCount;
+	}
+	return MA_SUCCESS;
 }
 
 YM2612DataSource::YM2612DataSource() {
@@ -37,11 +51,15 @@ YM2612DataSource::~YM2612DataSource() {
 }
 
 ma_result YM2612DataSource_read(ma_data_source *pDataSource, void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead){
-	return reinterpret_cast<YM2612DataSource *>(pDataSource)->read(pFramesOut, frameCount, *pFramesRead);
+	return reinterpret_cast<YM2612DataSource *>(pDataSource)->read(pFramesOut, frameCount, pFramesRead);
 }
 ma_result YM2612DataSource_seek(ma_data_source *pDataSource, ma_uint64 frameIndex) {
 	// Seek to a specific PCM frame here. Return MA_NOT_IMPLEMENTED if seeking is not supported.
-	return MA_NOT_IMPLEMENTED;
+	// Only frames covered by the keyframe history can be reached (see OPN_SetKeyframeInterval)
+	if(SeekStream(frameIndex)){
+		return MA_BAD_SEEK;
+	}
+	return MA_SUCCESS;
 }
 ma_result YM2612DataSource_get_data_format(ma_data_source *pDataSource, ma_format *pFormat, ma_uint32 *pChannels, ma_uint32 *pSampleRate, ma_channel *pChannelMap, size_t channelMapCap) {
 	std::span<ma_channel> channelMap = {pChannelMap, channelMapCap};
@@ -62,11 +80,11 @@ ma_result YM2612DataSource_get_data_format(ma_data_source *pDataSource, ma_forma
 }
 ma_result YM2612DataSource_get_cursor(ma_data_source *pDataSource, ma_uint64 *pCursor) {
 	// Retrieve the current position of the cursor here. Return MA_NOT_IMPLEMENTED and set *pCursor to 0 if there is no notion of a cursor.
-	*pCursor = 0;
-	return MA_NOT_IMPLEMENTED;
+	*pCursor = GetStreamCursor();
+	return MA_SUCCESS;
 }
 ma_result YM2612DataSource_get_length(ma_data_source *pDataSource, ma_uint64 *pLength) {
 	// Retrieve the length in PCM frames here. Return MA_NOT_IMPLEMENTED and set *pLength to 0 if there is no notion of a length or if the length is unknown.
-	*pLength = 0;
-	return MA_NOT_IMPLEMENTED;
+	*pLength = GetStreamLength();
+	return *pLength ? MA_SUCCESS : MA_NOT_IMPLEMENTED;
 }
@@ -15,7 +15,7 @@ class YM2612DataSource {
 	static ma_data_source_vtable vtable;
 
 public:
-	ma_result read(void *pFramesOut, ma_uint64 &frameCount, const ma_uint64 &pFramesRead = 0);
+	ma_result read(void *pFramesOut, ma_uint64 frameCount, ma_uint64 *pFramesRead = nullptr);
 
 	YM2612DataSource();
 	~YM2612DataSource();
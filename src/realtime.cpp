@@ -0,0 +1,112 @@
+// realtime.cpp - platform side of OPN_SetRealtimeOptions
+
+#include "realtime.hpp"
+#include "OPN_DLL.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Realtime {
+#ifdef _WIN32
+	bool SetScheduling(uint8_t Policy, int32_t Priority){
+		int ThreadPriority = THREAD_PRIORITY_NORMAL;
+		switch(Policy){
+			case OPN_SCHED_FIFO:
+			case OPN_SCHED_RR:
+				ThreadPriority = THREAD_PRIORITY_TIME_CRITICAL;    // what the waveOut thread used
+				break;
+			case OPN_SCHED_NICE:
+				// nice levels mapped onto the relative thread priorities
+				if(Priority <= -10){
+					ThreadPriority = THREAD_PRIORITY_HIGHEST;
+				}else if(Priority < 0){
+					ThreadPriority = THREAD_PRIORITY_ABOVE_NORMAL;
+				}else if(Priority > 0){
+					ThreadPriority = THREAD_PRIORITY_BELOW_NORMAL;
+				}
+				break;
+			default:
+				return true;
+		}
+		return SetThreadPriority(GetCurrentThread(), ThreadPriority) != 0;
+	}
+
+	bool SetAffinity(uint64_t CPUMask){
+		return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(CPUMask)) != 0;
+	}
+
+	bool LockMemory(const void *Data, size_t Size){
+		return VirtualLock(const_cast<void *>(Data), Size) != 0;
+	}
+
+	void UnlockMemory(const void *Data, size_t Size){
+		VirtualUnlock(const_cast<void *>(Data), Size);
+	}
+#else
+	bool SetScheduling(uint8_t Policy, int32_t Priority){
+		sched_param Param{};
+		switch(Policy){
+			case OPN_SCHED_FIFO:
+			case OPN_SCHED_RR:
+				Param.sched_priority = Priority;
+				return pthread_setschedparam(pthread_self(), Policy == OPN_SCHED_FIFO ? SCHED_FIFO : SCHED_RR, &Param) == 0;
+			case OPN_SCHED_NICE:
+#ifdef __linux__
+				// Linux keeps a nice level per thread, setpriority takes the thread ID for it
+				return pthread_setschedparam(pthread_self(), SCHED_OTHER, &Param) == 0
+				       && setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), Priority) == 0;
+#else
+				return false;    // nice applies to the whole process elsewhere
+#endif
+			default:
+				return true;
+		}
+	}
+
+	bool SetAffinity(uint64_t CPUMask){
+#ifdef __linux__
+		cpu_set_t Set;
+		CPU_ZERO(&Set);
+		for(size_t CPU = 0; CPU < 64; CPU++){
+			if(CPUMask & (1ull << CPU)){
+				CPU_SET(CPU, &Set);
+			}
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set) == 0;
+#else
+		static_cast<void>(CPUMask);
+		return false;    // macOS only has affinity hints
+#endif
+	}
+
+	bool LockMemory(const void *Data, size_t Size){
+		return mlock(Data, Size) == 0;
+	}
+
+	void UnlockMemory(const void *Data, size_t Size){
+		munlock(Data, Size);
+	}
+#endif
+
+	// Page faults on the stack would otherwise happen the first time a deep call runs in the middle of playback
+#ifdef _MSC_VER
+	__declspec(noinline)
+#else
+	__attribute__((noinline))
+#endif
+	void PrefaultStack(){
+		uint8_t Stack[STACK_PREFAULT];
+		volatile uint8_t *Touch = Stack;    // volatile, so the stores aren't optimized away
+		for(size_t Pos = 0; Pos < STACK_PREFAULT; Pos += 0x1000){
+			Touch[Pos] = 0;
+		}
+	}
+}
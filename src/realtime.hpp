@@ -0,0 +1,18 @@
+// realtime.hpp - scheduling, CPU affinity and memory locking for the rendering thread, see OPN_SetRealtimeOptions
+// All of them report whether the OS granted the request, without privileges most of them are refused.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Realtime {
+	constexpr size_t STACK_PREFAULT = 0x10000;    // bytes of stack the rendering thread touches up front
+
+	// Policy: OPN_SCHED_*, Priority as documented there. For the calling thread.
+	bool SetScheduling(uint8_t Policy, int32_t Priority);
+	bool SetAffinity(uint64_t CPUMask);
+	void PrefaultStack();
+
+	bool LockMemory(const void *Data, size_t Size);
+	void UnlockMemory(const void *Data, size_t Size);    // harmless on memory that isn't locked
+}
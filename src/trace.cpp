@@ -0,0 +1,89 @@
+// trace.cpp - per-thread trace event rings and the Chrome trace-event writer
+
+#include "trace.hpp"
+
+#ifdef OPN_TRACE
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Trace {
+	struct Event {
+		const char *Name;
+		uint64_t Start;    // ns
+		uint64_t Duration;
+		int32_t Arg;
+	};
+
+	// Written by its thread only. The dump reads it from another thread, events
+	// that are overwritten while it does so are skipped instead of locking the writer.
+	struct Ring {
+		uint32_t ThreadIndex;
+		std::atomic<uint64_t> Written{0};
+		uint64_t Dumped = 0;    // owned by Dump, events before it were written out already
+		std::vector<Event> Events = std::vector<Event>(RING_SIZE);
+	};
+
+	// rings stay alive after their thread exits, so its events can still be dumped
+	static std::mutex RingsGuard;
+	static std::vector<std::unique_ptr<Ring>> Rings;
+
+	static Ring &ThreadRing(){
+		thread_local Ring *Own = [] {
+			const std::lock_guard lock(RingsGuard);
+			Rings.push_back(std::make_unique<Ring>());
+			Rings.back()->ThreadIndex = static_cast<uint32_t>(Rings.size());
+			return Rings.back().get();
+		}();
+		return *Own;
+	}
+
+	static uint64_t Now(){
+		static const auto Epoch = std::chrono::steady_clock::now();
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Epoch).count());
+	}
+
+	Scope::Scope(const char *Name, int32_t Arg) : Name(Name), Arg(Arg), Start(Now()){}
+
+	Scope::~Scope(){
+		Ring &Own = ThreadRing();
+		uint64_t Index = Own.Written.load(std::memory_order_relaxed);
+		Own.Events[Index % RING_SIZE] = {Name, Start, Now() - Start, Arg};
+		Own.Written.store(Index + 1, std::memory_order_release);
+	}
+
+	bool Dump(const char *FileName){
+		FILE *File = std::fopen(FileName, "w");
+		if(File == nullptr){
+			return false;
+		}
+
+		std::fprintf(File, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+		const char *Separator = "\n";
+		const std::lock_guard lock(RingsGuard);
+		for(const auto &Own : Rings){
+			uint64_t End = Own->Written.load(std::memory_order_acquire);
+			// keep clear of the part the writer may be overwriting right now
+			uint64_t Begin = std::max(Own->Dumped, End > RING_SIZE * 3 / 4 ? End - RING_SIZE * 3 / 4 : 0);
+			for(uint64_t Index = Begin; Index < End; Index++){
+				Event Evt = Own->Events[Index % RING_SIZE];
+				std::fprintf(File, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+				             Separator, Evt.Name, Own->ThreadIndex, static_cast<double>(Evt.Start) / 1000.0,
+				             static_cast<double>(Evt.Duration) / 1000.0);
+				if(Evt.Arg >= 0){
+					std::fprintf(File, ", \"args\": {\"arg\": %d}", Evt.Arg);
+				}
+				std::fputc('}', File);
+				Separator = ",\n";
+			}
+			Own->Dumped = End;
+		}
+		std::fprintf(File, "\n]}\n");
+		return std::fclose(File) == 0;
+	}
+}
+#endif
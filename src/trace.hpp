@@ -0,0 +1,35 @@
+// trace.hpp - optional timeline tracing, enabled with the OPN_TRACE build option
+// Every thread records its scopes into its own ring buffer, OPN_DumpTrace writes them as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev). Without OPN_TRACE the macros expand to nothing.
+#pragma once
+
+#include <cstdint>
+
+#ifdef OPN_TRACE
+namespace Trace {
+	constexpr uint32_t RING_SIZE = 1u << 18;    // events per thread, the oldest ones are overwritten
+
+	class Scope {
+	public:
+		// Name has to be a string literal, only the pointer is recorded
+		explicit Scope(const char *Name, int32_t Arg = -1);
+		~Scope();
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+	private:
+		const char *Name;
+		int32_t Arg;
+		uint64_t Start;
+	};
+
+	bool Dump(const char *FileName);
+}
+
+#define OPN_TRACE_CONCAT_(A, B) A##B
+#define OPN_TRACE_CONCAT(A, B) OPN_TRACE_CONCAT_(A, B)
+// Records the rest of the enclosing block, optionally with an integer argument (chip number, frame count)
+#define OPN_TRACE_SCOPE(...) const Trace::Scope OPN_TRACE_CONCAT(TraceScope_, __LINE__){__VA_ARGS__}
+#else
+#define OPN_TRACE_SCOPE(...) do {} while(false)
+#endif
@@ -131,6 +131,21 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FM_TARGET(isa)	/* MSVC allows all intrinsics everywhere */
+#else
+#define FM_TARGET(isa)	__attribute__((target(isa)))
+#endif
+#endif
 
 /* globals */
 constexpr auto FREQ_SH = 16; /* 16.16 fixed point (frequency calculations) */
@@ -630,9 +645,11 @@ enum Slot {
 
 struct ym2612_state {
 	YM2612 *chip;
+	bool owned;    /* allocated by device_start_ym2612, not placed in caller memory */
 };
 
-static std::array<ym2612_state, MAX_CHIPS> YM2612Data;
+/* one entry per possible chip ID, the chips themselves are only allocated when started */
+static std::array<ym2612_state, 0x100> YM2612Data;
 
 /* update request from fm.c */
 void ym2612_update_request(void *param) {
@@ -649,22 +666,24 @@ void ym2612_stream_update(uint8_t ChipID, stream_sample_t **outputs, size_t samp
 	info->chip->update(outputs, samples);
 }
 
-int device_start_ym2612(uint8_t ChipID, int clock) {
-	if(ChipID >= MAX_CHIPS) {
-		return 0;
-	}
-
+int device_start_ym2612(uint8_t ChipID, int clock, void *memory) {
 	ym2612_state *info = &YM2612Data[ChipID];
 	auto rate = clock / 144;
 
 	/**** initialize YM2612 ****/
-	info->chip = new YM2612(info, clock, rate);
+	info->owned = memory == nullptr;
+	info->chip = info->owned ? new YM2612(info, clock, rate) : new(memory) YM2612(info, clock, rate);
 	return rate;
 }
 
 void device_stop_ym2612(uint8_t ChipID) {
 	ym2612_state *info = &YM2612Data[ChipID];
-	delete info->chip;
+	if(info->owned) {
+		delete info->chip;
+	} else if(info->chip != nullptr) {
+		info->chip->~YM2612();
+	}
+	info->chip = nullptr;
 }
 
 void device_reset_ym2612(uint8_t ChipID) {
@@ -677,12 +696,53 @@ void ym2612_w(uint8_t ChipID, offs_t offset, uint8_t data) {
 	info->chip->write(offset & 3, data);
 }
 
+uint8_t ym2612_r(uint8_t ChipID, offs_t offset) {
+	ym2612_state *info = &YM2612Data[ChipID];
+	return info->chip->read(offset & 3);
+}
+
+bool ym2612_timer_running(uint8_t ChipID) {
+	ym2612_state *info = &YM2612Data[ChipID];
+	return info->chip->timer_horizon() != SIZE_MAX;
+}
+
+bool ym2612_silent(uint8_t ChipID) {
+	ym2612_state *info = &YM2612Data[ChipID];
+	return info->chip->silent();
+}
+
+uint32_t ym2612_timer_b_ticks(uint8_t ChipID) {
+	ym2612_state *info = &YM2612Data[ChipID];
+	return info->chip->timer_b_ticks;
+}
+
+void ym2612_stream_skip(uint8_t ChipID, size_t samples) {
+	ym2612_state *info = &YM2612Data[ChipID];
+	info->chip->advance(samples);
+}
+
 void ym2612_set_mute_mask(uint8_t ChipID, uint32_t MuteMask) {
 	ym2612_state *info = &YM2612Data[ChipID];
 	info->chip->set_mutemask(MuteMask);
 }
 
+void ym2612_save_state(uint8_t ChipID, YM2612_STATE &State) {
+	ym2612_state *info = &YM2612Data[ChipID];
+	info->chip->save_state(State);
+}
+
+bool ym2612_load_state(uint8_t ChipID, const YM2612_STATE &State) {
+	ym2612_state *info = &YM2612Data[ChipID];
+	return info->chip->load_state(State);
+}
+
 void FM_SLOT::KEYON(uint8_t CsmOn) {
+	KEYON_CSM(CsmOn);
+	key = 1;
+}
+
+/* key on without changing the key flag, used by the CSM auto key on (and KEYON) */
+void FM_SLOT::KEYON_CSM(uint8_t CsmOn) {
 	if(!key && !CsmOn) {
 		/* restart Phase Generator */
 		phase = 0;
@@ -707,8 +767,6 @@ void FM_SLOT::KEYON(uint8_t CsmOn) {
 			vol_out = (uint32_t) volume + tl;
 		}
 	}
-
-	key = 1;
 }
 
 void FM_SLOT::KEYOFF(uint8_t CsmOn) {
@@ -790,11 +848,13 @@ void FM_OPN::set_timers(FM_STATE &ST, int v) {
 	}
 
 	/* reset Timer b flag */
-	//if( v & 0x20 )
-	//	FM_STATUS_RESET(ST,0x02);
+	if(v & 0x20) {
+		ST.status &= ~0x02;
+	}
 	/* reset Timer a flag */
-	//if( v & 0x10 )
-	//	FM_STATUS_RESET(ST,0x01);
+	if(v & 0x10) {
+		ST.status &= ~0x01;
+	}
 	/* load b */
 	if(v & 0x02) {
 		if(ST.TBC == 0) {
@@ -911,9 +971,9 @@ void FM_OPN::setup_connection(FM_CHANNEL &CH, int ch) {
 }
 
 /* set detune & multiple */
-void FM_SLOT::set_det_mul(FM_STATE &ST, FM_CHANNEL &CH, int v) {
+void FM_SLOT::set_det_mul(const FM_RATE_TABLES &tables, FM_CHANNEL &CH, int v) {
 	mul = static_cast<bool>(v & 0x0f) ? (v & 0x0f) * 2 : 1;
-	DT = ST.dt_tab[(v >> 4) & 7];
+	DT = tables.dt_tab[(v >> 4) & 7];
 	CH.SLOTs[SLOT1].Incr = -1;
 }
 
@@ -1205,10 +1265,10 @@ void FM_OPN::update_phase_lfo_slot(FM_SLOT &SLOT, int32_t pms, uint32_t block_fn
 		/* Thanks to Blargg - his patch that helped me to find this bug */
 
 		/* recalculate (frequency) phase increment counter */
-		int32_t fc = static_cast<int32_t>(fn_table[fn] >> (7 - blk)) + SLOT.DT[kc];
+		int32_t fc = static_cast<int32_t>(tables->fn_table[fn] >> (7 - blk)) + SLOT.DT[kc];
 
 		/* (frequency) phase overflow (credits to Nemesis) */
-		if(fc < 0) { fc += static_cast<int32_t>(fn_max); }
+		if(fc < 0) { fc += static_cast<int32_t>(tables->fn_max); }
 
 		/* update phase */
 		SLOT.phase += (fc * SLOT.mul) >> 1;
@@ -1235,23 +1295,24 @@ void FM_OPN::update_phase_lfo_channel(FM_CHANNEL &CH) {
 		uint32_t kc = (blk << 2) | opn_fktable[fn >> 8];
 
 		/* recalculate (frequency) phase increment counter */
-		auto fc = static_cast<int32_t>(fn_table[fn] >> (7 - blk));
+		auto fc = static_cast<int32_t>(tables->fn_table[fn] >> (7 - blk));
+		auto fn_max = static_cast<int32_t>(tables->fn_max);
 
 		/* (frequency) phase overflow (credits to Nemesis) */
 		int32_t finc = fc + CH.SLOTs[SLOT1].DT[kc];
-		if(finc < 0) finc += static_cast<int32_t>(fn_max);
+		if(finc < 0) finc += fn_max;
 		CH.SLOTs[SLOT1].phase += (finc * CH.SLOTs[SLOT1].mul) >> 1;
 
 		finc = fc + CH.SLOTs[SLOT2].DT[kc];
-		if(finc < 0) finc += static_cast<int32_t>(fn_max);
+		if(finc < 0) finc += fn_max;
 		CH.SLOTs[SLOT2].phase += (finc * CH.SLOTs[SLOT2].mul) >> 1;
 
 		finc = fc + CH.SLOTs[SLOT3].DT[kc];
-		if(finc < 0) finc += static_cast<int32_t>(fn_max);
+		if(finc < 0) finc += fn_max;
 		CH.SLOTs[SLOT3].phase += (finc * CH.SLOTs[SLOT3].mul) >> 1;
 
 		finc = fc + CH.SLOTs[SLOT4].DT[kc];
-		if(finc < 0) finc += static_cast<int32_t>(fn_max);
+		if(finc < 0) finc += fn_max;
 		CH.SLOTs[SLOT4].phase += (finc * CH.SLOTs[SLOT4].mul) >> 1;
 	} else { /* LFO phase modulation  = zero */
 		CH.SLOTs[SLOT1].phase += CH.SLOTs[SLOT1].Incr;
@@ -1268,7 +1329,7 @@ void FM_OPN::refresh_fc_eg_slot(FM_SLOT &SLOT, int fc, int kc) {
 	fc += SLOT.DT[kc];
 
 	/* detects frequency overflow (credits to Nemesis) */
-	if(fc < 0) fc += fn_max;
+	if(fc < 0) fc += tables->fn_max;
 
 	/* (frequency) phase increment counter */
 	SLOT.Incr = (fc * SLOT.mul) >> 1;
@@ -1333,57 +1394,309 @@ constexpr auto volume_calc(FM_SLOT &SLOT, const uint32_t &AM) {
 	return SLOT.vol_out + (AM & SLOT.AMmask);
 }
 
-void YM2612::chan_calc(FM_CHANNEL &channel) {
-	if(channel.Muted) {
-		return;
+/* operator connections of each algorithm, same as setup_connection() but known at compile time */
+enum FM_NODE : uint8_t {
+	NODE_M2,
+	NODE_C1,
+	NODE_C2,
+	NODE_MEM,
+	NODE_OUT,
+	NODE_ALGO5,    /* SLOT1 feeds C1, C2 and MEM */
+};
+
+struct FM_ALGO_CONNECT {
+	FM_NODE connect1;    /* SLOT1 output */
+	FM_NODE connect3;    /* SLOT3 output */
+	FM_NODE connect2;    /* SLOT2 output */
+	FM_NODE mem_connect; /* delayed sample (MEM) */
+};
+
+constexpr std::array<FM_ALGO_CONNECT, 8> algo_connect = {{
+		{NODE_C1, NODE_C2, NODE_MEM, NODE_M2},      /* M1---C1---MEM---M2---C2---OUT */
+		{NODE_MEM, NODE_C2, NODE_MEM, NODE_M2},     /* M1------+-MEM---M2---C2---OUT */
+		{NODE_C2, NODE_C2, NODE_MEM, NODE_M2},      /* M1-----------------+-C2---OUT */
+		{NODE_C1, NODE_C2, NODE_MEM, NODE_C2},      /* M1---C1---MEM------+-C2---OUT */
+		{NODE_C1, NODE_C2, NODE_OUT, NODE_MEM},     /* M1---C1-+-OUT, M2---C2-+      */
+		{NODE_ALGO5, NODE_OUT, NODE_OUT, NODE_M2},  /* M1-+-MEM---M2-+-OUT, C1, C2   */
+		{NODE_C1, NODE_OUT, NODE_OUT, NODE_MEM},    /* M1---C1-+, M2-+, C2-+-OUT     */
+		{NODE_OUT, NODE_OUT, NODE_OUT, NODE_MEM},   /* M1-+, C1-+, M2-+, C2-+-OUT    */
+}};
+
+/* One operator over a block: out[k] += op_calc(phase[k], env[k], pm[k]) (op_calc1 for PM_SHIFT 0). */
+/* Samples are independent of each other here, so this runs across time.                          */
+/* Quiet envelopes need no special case: (env << 3) is already >= TL_TAB_LEN for them.             */
+/* The SIMD variants leave the samples that don't fill a whole vector to the scalar one.           */
+template<int PM_SHIFT>
+static void op_calc_block_scalar(int32_t *out, const uint32_t *phase, const uint32_t *env, const int32_t *pm, size_t length) {
+	for(size_t k = 0; k < length; k++) {
+		if constexpr(PM_SHIFT == 0) {
+			out[k] += op_calc1(phase[k], env[k], pm[k]);
+		} else {
+			out[k] += op_calc(phase[k], env[k], pm[k]);
+		}
 	}
+}
 
-	OPN.m2 = OPN.c1 = OPN.c2 = OPN.mem = 0;
+#ifdef FM_X86
+/* no gathers: the index math is done 4 wide, the table lookups one by one */
+template<int PM_SHIFT>
+FM_TARGET("sse4.1")
+static void op_calc_block_sse41(int32_t *out, const uint32_t *phase, const uint32_t *env, const int32_t *pm, size_t length) {
+	const __m128i phase_mask = _mm_set1_epi32(~FREQ_MASK);
+	const __m128i sin_mask = _mm_set1_epi32(SIN_MASK);
+	const __m128i tl_len = _mm_set1_epi32(TL_TAB_LEN);
+	size_t k = 0;
+	for(; k + 4 <= length; k += 4) {
+		__m128i ph = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&phase[k]));
+		__m128i eg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&env[k]));
+		__m128i mod = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&pm[k]));
+
+		ph = _mm_add_epi32(_mm_and_si128(ph, phase_mask), _mm_slli_epi32(mod, PM_SHIFT));
+		__m128i idx = _mm_and_si128(_mm_srli_epi32(ph, FREQ_SH), sin_mask);
+		__m128i sin = _mm_setr_epi32(sin_tab[_mm_extract_epi32(idx, 0)], sin_tab[_mm_extract_epi32(idx, 1)],
+		                             sin_tab[_mm_extract_epi32(idx, 2)], sin_tab[_mm_extract_epi32(idx, 3)]);
+		__m128i p = _mm_add_epi32(_mm_slli_epi32(eg, 3), sin);
+		__m128i inside = _mm_cmpgt_epi32(tl_len, p);
+		p = _mm_and_si128(p, inside);
+		__m128i val = _mm_setr_epi32(tl_tab[_mm_extract_epi32(p, 0)], tl_tab[_mm_extract_epi32(p, 1)],
+		                             tl_tab[_mm_extract_epi32(p, 2)], tl_tab[_mm_extract_epi32(p, 3)]);
+
+		__m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&out[k]));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(&out[k]), _mm_add_epi32(acc, _mm_and_si128(val, inside)));
+	}
+	op_calc_block_scalar<PM_SHIFT>(out + k, phase + k, env + k, pm + k, length - k);
+}
 
-	*channel.mem_connect = channel.mem_value; /* restore delayed sample (MEM) value to m2 or c2 */
+template<int PM_SHIFT>
+FM_TARGET("avx2")
+static void op_calc_block_avx2(int32_t *out, const uint32_t *phase, const uint32_t *env, const int32_t *pm, size_t length) {
+	const __m256i phase_mask = _mm256_set1_epi32(~FREQ_MASK);
+	const __m256i sin_mask = _mm256_set1_epi32(SIN_MASK);
+	const __m256i tl_len = _mm256_set1_epi32(TL_TAB_LEN);
+	size_t k = 0;
+	for(; k + 8 <= length; k += 8) {
+		__m256i ph = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&phase[k]));
+		__m256i eg = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&env[k]));
+		__m256i mod = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&pm[k]));
+
+		ph = _mm256_add_epi32(_mm256_and_si256(ph, phase_mask), _mm256_slli_epi32(mod, PM_SHIFT));
+		__m256i idx = _mm256_and_si256(_mm256_srli_epi32(ph, FREQ_SH), sin_mask);
+		__m256i p = _mm256_add_epi32(_mm256_slli_epi32(eg, 3), _mm256_i32gather_epi32(sin_tab.data(), idx, 4));
+		__m256i inside = _mm256_cmpgt_epi32(tl_len, p);
+		__m256i val = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), tl_tab.data(), _mm256_and_si256(p, inside), inside, 4);
+
+		__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&out[k]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(&out[k]), _mm256_add_epi32(acc, val));
+	}
+	op_calc_block_scalar<PM_SHIFT>(out + k, phase + k, env + k, pm + k, length - k);
+}
 
-	uint32_t AM = OPN.LFO_AM >> channel.ams;
-	unsigned int eg_out = volume_calc(channel.SLOTs[SLOT1], AM);
-	int32_t out = channel.op1_out[0] + channel.op1_out[1];
-	channel.op1_out[0] = channel.op1_out[1];
+/* a whole block in one go */
+template<int PM_SHIFT>
+FM_TARGET("avx512f")
+static void op_calc_block_avx512(int32_t *out, const uint32_t *phase, const uint32_t *env, const int32_t *pm, size_t length) {
+	/* the zero-masked forms only because GCC 12 warns about the unmasked ones (PR 105593) */
+	constexpr __mmask16 all = 0xFFFF;
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i phase_mask = _mm512_set1_epi32(~FREQ_MASK);
+	const __m512i sin_mask = _mm512_set1_epi32(SIN_MASK);
+	const __m512i tl_len = _mm512_set1_epi32(TL_TAB_LEN);
+	size_t k = 0;
+	for(; k + 16 <= length; k += 16) {
+		__m512i ph = _mm512_loadu_si512(&phase[k]);
+		__m512i eg = _mm512_loadu_si512(&env[k]);
+		__m512i mod = _mm512_loadu_si512(&pm[k]);
+
+		ph = _mm512_add_epi32(_mm512_and_si512(ph, phase_mask), _mm512_maskz_slli_epi32(all, mod, PM_SHIFT));
+		__m512i idx = _mm512_and_si512(_mm512_maskz_srli_epi32(all, ph, FREQ_SH), sin_mask);
+		__m512i sin = _mm512_mask_i32gather_epi32(zero, all, idx, sin_tab.data(), 4);
+		__m512i p = _mm512_add_epi32(_mm512_maskz_slli_epi32(all, eg, 3), sin);
+		__mmask16 inside = _mm512_cmpgt_epi32_mask(tl_len, p);
+		__m512i val = _mm512_mask_i32gather_epi32(zero, inside, p, tl_tab.data(), 4);
+
+		_mm512_storeu_si512(&out[k], _mm512_add_epi32(_mm512_loadu_si512(&out[k]), val));
+	}
+	op_calc_block_scalar<PM_SHIFT>(out + k, phase + k, env + k, pm + k, length - k);
+}
 
-	if(!channel.connect1) {
-		/* algorithm 5  */
-		OPN.mem = OPN.c1 = OPN.c2 = channel.op1_out[0];
-	} else {
-		/* other algorithms */
-		*channel.connect1 += channel.op1_out[0];
+static bool fm_isa_supported(FM_ISA isa) {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+	__cpuid(info, 1);
+	const bool sse41 = info[2] & (1 << 19);
+	const bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x06) == 0x06;
+	const bool os_avx512 = os_avx && (_xgetbv(0) & 0xE6) == 0xE6;
+	int ext[4] = {};
+	if(max_leaf >= 7) {
+		__cpuidex(ext, 7, 0);
+	}
+	switch(isa) {
+		case FM_ISA::SCALAR: return true;
+		case FM_ISA::SSE41: return sse41;
+		case FM_ISA::AVX2: return os_avx && (ext[1] & (1 << 5));
+		case FM_ISA::AVX512: return os_avx512 && (ext[1] & (1 << 16));
 	}
+	return false;
+#else
+	__builtin_cpu_init();    /* may run before the constructor that does it */
+	switch(isa) {
+		case FM_ISA::SCALAR: return true;
+		case FM_ISA::SSE41: return __builtin_cpu_supports("sse4.1");
+		case FM_ISA::AVX2: return __builtin_cpu_supports("avx2");
+		case FM_ISA::AVX512: return __builtin_cpu_supports("avx512f");
+	}
+	return false;
+#endif
+}
+#else
+static bool fm_isa_supported(FM_ISA isa) {
+	return isa == FM_ISA::SCALAR;
+}
+#endif
 
-	channel.op1_out[1] = 0;
-	if(eg_out < ENV_QUIET) /* SLOT 1 */
-	{
-		if(!channel.FB) {
-			out = 0;
-		}
+/* kernels in use, shared by all chips */
+using OP_CALC_BLOCK = void (*)(int32_t *out, const uint32_t *phase, const uint32_t *env, const int32_t *pm, size_t length);
+struct FM_KERNELS {
+	FM_ISA isa;
+	OP_CALC_BLOCK op_calc1_block;   /* PM_SHIFT 0 */
+	OP_CALC_BLOCK op_calc_block;    /* PM_SHIFT 15 */
+};
 
-		channel.op1_out[1] = op_calc1(channel.SLOTs[SLOT1].phase, eg_out, (out << channel.FB));
+static FM_KERNELS fm_kernels_for(FM_ISA isa) {
+	switch(isa) {
+#ifdef FM_X86
+		case FM_ISA::SSE41: return {isa, op_calc_block_sse41<0>, op_calc_block_sse41<15>};
+		case FM_ISA::AVX2: return {isa, op_calc_block_avx2<0>, op_calc_block_avx2<15>};
+		case FM_ISA::AVX512: return {isa, op_calc_block_avx512<0>, op_calc_block_avx512<15>};
+#endif
+		default: return {FM_ISA::SCALAR, op_calc_block_scalar<0>, op_calc_block_scalar<15>};
 	}
+}
+
+static FM_KERNELS fm_kernels = {FM_ISA::SCALAR, op_calc_block_scalar<0>, op_calc_block_scalar<15>};
 
-	eg_out = volume_calc(channel.SLOTs[SLOT3], AM);
-	if(eg_out < ENV_QUIET) { /* SLOT 3 */
-		*channel.connect3 += op_calc(channel.SLOTs[SLOT3].phase, eg_out, OPN.m2);
+FM_ISA ym2612_supported_isa(FM_ISA max) {
+	auto level = static_cast<uint8_t>(max);
+	while(level > static_cast<uint8_t>(FM_ISA::SCALAR) && !fm_isa_supported(static_cast<FM_ISA>(level))) {
+		level--;
 	}
+	return static_cast<FM_ISA>(std::max(level, static_cast<uint8_t>(FM_ISA::SCALAR)));
+}
+
+FM_ISA ym2612_select_isa(FM_ISA isa) {
+	fm_kernels = fm_kernels_for(ym2612_supported_isa(isa));
+	return fm_kernels.isa;
+}
+
+FM_ISA ym2612_get_isa() {
+	return fm_kernels.isa;
+}
 
-	eg_out = volume_calc(channel.SLOTs[SLOT2], AM);
-	if(eg_out < ENV_QUIET) { /* SLOT 2 */
-		*channel.connect2 += op_calc(channel.SLOTs[SLOT2].phase, eg_out, OPN.c1);
+/* operators of one channel over a block, the connections are resolved at compile time. */
+/* Apart from SLOT1 feedback, the only links between samples are the one sample delays */
+/* of SLOT1 and MEM, so every operator is evaluated across the whole block at once.     */
+template<int ALGO>
+static void chan_calc_algo(FM_CHANNEL &channel, FM_BLOCK_BUFFER &block, int ch, size_t length) {
+	constexpr FM_ALGO_CONNECT connect = algo_connect[ALGO];
+	static constexpr std::array<int32_t, FM_BLOCK> no_pm{};
+	const auto &env = block.env[ch];
+	const auto &phase = block.phase[ch];
+
+	/* m2, c1, c2, mem, carrier of every sample */
+	alignas(32) std::array<std::array<int32_t, FM_BLOCK>, 5> node{};
+	auto &mem = node[NODE_MEM];
+
+	/* SLOT1 output, op1[k + 2] belongs to sample k, the two before are op1_out */
+	alignas(32) std::array<int32_t, FM_BLOCK + 2> op1{};
+	op1[0] = channel.op1_out[0];
+	op1[1] = channel.op1_out[1];
+
+	/* SLOT 1 */
+	if(channel.FB) {
+		/* self-feedback: each sample depends on the two before */
+		for(size_t k = 0; k < length; k++) {
+			unsigned int eg_out = env[SLOT1][k];
+			if(eg_out < ENV_QUIET) {
+				op1[k + 2] = op_calc1(phase[SLOT1][k], eg_out, ((op1[k] + op1[k + 1]) << channel.FB));
+			}
+		}
+	} else {
+		fm_kernels.op_calc1_block(&op1[2], phase[SLOT1].data(), env[SLOT1].data(), no_pm.data(), length);
 	}
 
-	eg_out = volume_calc(channel.SLOTs[SLOT4], AM);
-	if(eg_out < ENV_QUIET) { /* SLOT 4 */
-		*channel.connect4 += op_calc(channel.SLOTs[SLOT4].phase, eg_out, OPN.c2);
+	/* SLOT1 output reaches the other operators one sample late */
+	for(size_t k = 0; k < length; k++) {
+		if constexpr(connect.connect1 == NODE_ALGO5) {
+			/* algorithm 5  */
+			mem[k] = node[NODE_C1][k] = node[NODE_C2][k] = op1[k + 1];
+		} else {
+			/* other algorithms */
+			node[connect.connect1][k] += op1[k + 1];
+		}
 	}
 
-	/* store current MEM */
-	channel.mem_value = OPN.mem;
+	/* SLOT 2 (only reads C1, which is complete now) */
+	fm_kernels.op_calc_block(node[connect.connect2].data(), phase[SLOT2].data(), env[SLOT2].data(), node[NODE_C1].data(), length);
 
-	/* update phase counters AFTER output calculations */
+	/* MEM is complete as well, restore the delayed sample (MEM) value to m2 or c2 */
+	if constexpr(connect.mem_connect == NODE_MEM) {
+		mem.fill(channel.mem_value); /* nothing else uses it, it is carried along unchanged */
+	} else {
+		node[connect.mem_connect][0] += channel.mem_value;
+		for(size_t k = 1; k < length; k++) {
+			node[connect.mem_connect][k] += mem[k - 1];
+		}
+		/* store current MEM */
+		channel.mem_value = mem[length - 1];
+	}
+
+	/* SLOT 3 */
+	fm_kernels.op_calc_block(node[connect.connect3].data(), phase[SLOT3].data(), env[SLOT3].data(), node[NODE_M2].data(), length);
+
+	/* SLOT 4 */
+	fm_kernels.op_calc_block(node[NODE_OUT].data(), phase[SLOT4].data(), env[SLOT4].data(), node[NODE_C2].data(), length);
+
+	block.out[ch] = node[NODE_OUT];
+	channel.op1_out[0] = op1[length];
+	channel.op1_out[1] = op1[length + 1];
+}
+
+void YM2612::chan_calc(FM_CHANNEL &channel, int ch, size_t length) {
+	/* envelope and phase of every sample come from the state pass (see render_block) */
+	switch(channel.ALGO) {
+		case 0: chan_calc_algo<0>(channel, block, ch, length); break;
+		case 1: chan_calc_algo<1>(channel, block, ch, length); break;
+		case 2: chan_calc_algo<2>(channel, block, ch, length); break;
+		case 3: chan_calc_algo<3>(channel, block, ch, length); break;
+		case 4: chan_calc_algo<4>(channel, block, ch, length); break;
+		case 5: chan_calc_algo<5>(channel, block, ch, length); break;
+		case 6: chan_calc_algo<6>(channel, block, ch, length); break;
+		case 7: chan_calc_algo<7>(channel, block, ch, length); break;
+	}
+}
+
+/* phase counter of one slot over a whole block: phase0 + k * Incr */
+static void phase_ramp(std::span<uint32_t, FM_BLOCK> phase, uint32_t phase0, uint32_t incr) {
+#if defined(__SSE2__) || defined(_M_X64)
+	static_assert(FM_BLOCK % 4 == 0);
+	__m128i ramp = _mm_setr_epi32(static_cast<int>(phase0), static_cast<int>(phase0 + incr),
+	                              static_cast<int>(phase0 + incr * 2), static_cast<int>(phase0 + incr * 3));
+	const __m128i step = _mm_set1_epi32(static_cast<int>(incr * 4));
+	for(size_t k = 0; k < FM_BLOCK; k += 4) {
+		_mm_store_si128(reinterpret_cast<__m128i *>(&phase[k]), ramp);
+		ramp = _mm_add_epi32(ramp, step);
+	}
+#else
+	for(size_t k = 0; k < FM_BLOCK; k++) {
+		phase[k] = phase0 + incr * static_cast<uint32_t>(k);
+	}
+#endif
+}
+
+/* advance the phase counters of a channel by one sample */
+void YM2612::advance_phase(FM_CHANNEL &channel) {
 	if(channel.pms) {
 		/* add support for 3 slot mode */
 		if((OPN.STATE.mode & 0xC0) && (&channel == &this->CH[2])) {
@@ -1403,6 +1716,21 @@ void YM2612::chan_calc(FM_CHANNEL &channel) {
 	}
 }
 
+/* phase increment of every slot at the current LFO PM step, without advancing the phase */
+std::array<uint32_t, 4> YM2612::phase_step(FM_CHANNEL &channel) {
+	std::array<uint32_t, 4> phase{};
+	for(int s = 0; s < 4; s++) {
+		phase[s] = channel.SLOTs[s].phase;
+	}
+	advance_phase(channel);
+	std::array<uint32_t, 4> step{};
+	for(int s = 0; s < 4; s++) {
+		step[s] = channel.SLOTs[s].phase - phase[s];
+		channel.SLOTs[s].phase = phase[s];
+	}
+	return step;
+}
+
 static void FMCloseTable() {
 #ifdef SAVE_SAMPLE
 	fclose(sample[0]);
@@ -1481,7 +1809,7 @@ void FM_OPN::WriteReg(int reg, int value) {
 
 	switch(reg & 0xf0) {
 		case 0x30: /* DET , MUL */
-			SLOT.set_det_mul(STATE, CH, value);
+			SLOT.set_det_mul(*tables, CH, value);
 			break;
 
 		case 0x40: /* TL */
@@ -1603,7 +1931,7 @@ void FM_OPN::WriteReg(int reg, int value) {
 					/* keyscale code */
 					CH.kcode = (blk << 2) | opn_fktable[fn >> 7];
 					/* phase increment counter */
-					CH.fc = fn_table[fn * 2] >> (7 - blk);
+					CH.fc = tables->fn_table[fn * 2] >> (7 - blk);
 
 					/* store fnum in clear form for LFO PM calculations */
 					CH.block_fnum = (blk << 11) | fn;
@@ -1620,7 +1948,7 @@ void FM_OPN::WriteReg(int reg, int value) {
 						/* keyscale code */
 						SL3.kcode[c] = (blk << 2) | opn_fktable[fn >> 7];
 						/* phase increment counter */
-						SL3.fc[c] = fn_table[fn * 2] >> (7 - blk);
+						SL3.fc[c] = tables->fn_table[fn * 2] >> (7 - blk);
 						SL3.block_fnum[c] = (blk << 11) | fn;
 						(P_CH)[2].SLOTs[SLOT1].Incr = -1;
 					}
@@ -1658,15 +1986,15 @@ void FM_OPN::WriteReg(int reg, int value) {
 }
 
 /* initialize time tables */
-void FM_OPN::init_timetables(const double &freqbase) {
+static void init_timetables(FM_RATE_TABLES &tables, double freqbase) {
 	/* DeTune table */
 	for(int d = 0; d <= 3; d++) {
 		for(int i = 0; i <= 31; i++) {
 			double rate = static_cast<double>(dt_tab[d * 32 + i])
 			              * freqbase
 			              * (1 << (FREQ_SH - 10)); /* -10 because chip works with 10.10 fixed point, while we use 16.16 */
-			STATE.dt_tab[d][i] = static_cast<int32_t>(rate);
-			STATE.dt_tab[d + 4][i] = -STATE.dt_tab[d][i];
+			tables.dt_tab[d][i] = static_cast<int32_t>(rate);
+			tables.dt_tab[d + 4][i] = -tables.dt_tab[d][i];
 		}
 	}
 
@@ -1680,12 +2008,41 @@ void FM_OPN::init_timetables(const double &freqbase) {
 		/* where sample clock is  M/144 */
 		/* this means the increment value for one clock sample is FNUM * 2^(B-1) = FNUM * 64 for octave 7 */
 		/* we also need to handle the ratio between the chip frequency and the emulated frequency (can be 1.0)  */
-		fn_table[i] = static_cast<uint32_t>(static_cast<double>(i) * 32 * freqbase * (1 << (FREQ_SH - 10)));
+		tables.fn_table[i] = static_cast<uint32_t>(static_cast<double>(i) * 32 * freqbase * (1 << (FREQ_SH - 10)));
 		/* -10 because chip works with 10.10 fixed point, while we use 16.16 */
 	}
 
 	/* maximal frequency is required for Phase overflow calculation, register size is 17 bits (Nemesis) */
-	fn_max = static_cast<uint32_t>(static_cast<double>(0x20000) * freqbase * (1 << (FREQ_SH - 10)));
+	tables.fn_max = static_cast<uint32_t>(static_cast<double>(0x20000) * freqbase * (1 << (FREQ_SH - 10)));
+}
+
+/* Chips at the same clock, rate and prescaler share their time tables. The cache only holds weak */
+/* references, the tables go away with the last chip using them.                                  */
+struct rate_tables_entry {
+	uint32_t clock;
+	uint32_t rate;
+	int pres;
+	std::weak_ptr<const FM_RATE_TABLES> tables;
+};
+
+static std::mutex rate_tables_guard;
+static std::vector<rate_tables_entry> rate_tables_cache;
+
+static std::shared_ptr<const FM_RATE_TABLES> get_rate_tables(uint32_t clock, uint32_t rate, int pres, double freqbase) {
+	const std::lock_guard lock(rate_tables_guard);
+	std::erase_if(rate_tables_cache, [](const rate_tables_entry &entry) { return entry.tables.expired(); });
+	for(const auto &entry : rate_tables_cache) {
+		if(entry.clock == clock && entry.rate == rate && entry.pres == pres) {
+			if(auto tables = entry.tables.lock()) {
+				return tables;
+			}
+		}
+	}
+
+	auto tables = std::make_shared<FM_RATE_TABLES>();
+	init_timetables(*tables, freqbase);
+	rate_tables_cache.push_back({clock, rate, pres, tables});
+	return tables;
 }
 
 /* prescaler set (and make time tables) */
@@ -1706,8 +2063,8 @@ void FM_OPN::SetPres(int pres, int timer_prescaler) {
 	/* SSG part  prescaler set */
 	//if( SSGpres ) (*ST.SSG.set_clock)( ST.param, ST.clock * 2 / SSGpres );
 
-	/* make time tables */
-	init_timetables(STATE.freqbase);
+	/* make time tables, the slots pick them up again when their DT/MUL registers are written */
+	tables = get_rate_tables(STATE.clock, STATE.rate, pres, STATE.freqbase);
 }
 
 void YM2612::reset_channels(int num) {
@@ -1737,23 +2094,10 @@ void YM2612::reset_channels(int num) {
 /*      YM2612 local section                                                   */
 /*******************************************************************************/
 
-/* Generate samples for one of the YM2612s */
-void YM2612::update(FMSAMPLE **buffer, size_t length) {
-	/* set bufer */
-	FMSAMPLE *bufL = buffer[0];
-	FMSAMPLE *bufR = buffer[1];
-
-	std::span<FM_CHANNEL, 6> cch = CH;
-
-	int32_t dacOut;
-	if(MuteDAC) {
-		dacOut = 0;
-	} else {
-		dacOut = this->dacOut;
-	}
-
-	/* refresh PG and EG */
+/* refresh PG and EG of all channels */
+void YM2612::refresh_fc_eg() {
 	FM_OPN &opn = this->OPN;
+	std::span<FM_CHANNEL, 6> cch = CH;
 	opn.refresh_fc_eg_chan(cch[0]);
 	opn.refresh_fc_eg_chan(cch[1]);
 	if(opn.STATE.mode & 0xc0) {
@@ -1770,6 +2114,32 @@ void YM2612::update(FMSAMPLE **buffer, size_t length) {
 	opn.refresh_fc_eg_chan(cch[3]);
 	opn.refresh_fc_eg_chan(cch[4]);
 	opn.refresh_fc_eg_chan(cch[5]);
+}
+
+/* Generate samples for one of the YM2612s */
+void YM2612::update(FMSAMPLE **buffer, size_t length) {
+	/* set bufer */
+	FMSAMPLE *bufL = buffer[0];
+	FMSAMPLE *bufR = buffer[1];
+
+	std::span<FM_CHANNEL, 6> cch = CH;
+
+	int32_t dacOut;
+	if(MuteDAC) {
+		dacOut = 0;
+	} else {
+		dacOut = this->dacOut;
+	}
+
+	/* refresh PG and EG */
+	refresh_fc_eg();
+	if(length != 0 && silent()) {
+		/* the operators would only calculate zeros, just keep the counters going */
+		std::fill_n(bufL, length, 0);
+		std::fill_n(bufR, length, 0);
+		advance_counters(length);
+		return;
+	}
 	if(length == 0) {
 		for(auto &channel: cch) {
 			channel.update_ssg_eg_channel();
@@ -1784,20 +2154,99 @@ void YM2612::update(FMSAMPLE **buffer, size_t length) {
 		 */
 	}
 
-	/* buffering */
-	auto &out_fm = opn.out_fm;
-	for(decltype(length) i = 0; i < length; i++) {
-		/* clear outputs */
-		out_fm.fill(0);
-		/*
-		out_fm[0] = 0;
-		out_fm[1] = 0;
-		out_fm[2] = 0;
-		out_fm[3] = 0;
-		out_fm[4] = 0;
-		out_fm[5] = 0;
-		 */
+	/* buffering, blocks end on timer overflows */
+	for(size_t done = 0; done < length;) {
+		size_t run = std::min({length - done, FM_BLOCK, timer_horizon()});
+		bool timer_a = advance_timers(run);
+		render_block(&bufL[done], &bufR[done], run, dacOut, timer_a);
+		done += run;
+	}
+}
 
+/* Timers are counted in samples: Timer A steps once per sample, Timer B every 16 samples. */
+/* Instead of counting them down on every sample, updates are split where one overflows.  */
+
+/* samples until the next timer overflow, SIZE_MAX while both are stopped */
+size_t YM2612::timer_horizon() const {
+	const FM_STATE &ST = OPN.STATE;
+	size_t horizon = SIZE_MAX;
+	if(ST.TAC > 0) {
+		horizon = static_cast<size_t>(ST.TAC);
+	}
+	if(ST.TBC > 0) {
+		horizon = std::min(horizon, static_cast<size_t>(ST.TBC));
+	}
+	return horizon;
+}
+
+/* count the timers down by up to timer_horizon() samples, returns true if Timer A overflows on the last one */
+bool YM2612::advance_timers(size_t length) {
+	FM_STATE &ST = OPN.STATE;
+	bool timer_a = false;
+	if(ST.TAC > 0) {
+		ST.TAC -= static_cast<int32_t>(length);
+		if(ST.TAC == 0) {
+			/* set status (if enabled) and reload, the CSM key on follows in update_csm */
+			if(ST.mode & 0x04) {
+				ST.status |= 0x01;
+			}
+			ST.TAC = 1024 - ST.TA;
+			timer_a = true;
+		}
+	}
+	if(ST.TBC > 0) {
+		ST.TBC -= static_cast<int32_t>(length);
+		if(ST.TBC == 0) {
+			if(ST.mode & 0x08) {
+				ST.status |= 0x02;
+			}
+			ST.TBC = (256 - ST.TB) << 4;
+			timer_b_ticks++;
+		}
+	}
+	return timer_a;
+}
+
+/* Generate up to FM_BLOCK samples.                                                    */
+/* The chip state is stepped sample by sample first, recording envelopes and phases,  */
+/* then each channel's operators run over the whole block and the outputs get mixed.   */
+void YM2612::render_block(FMSAMPLE *bufL, FMSAMPLE *bufR, size_t length, int32_t dacOut, bool timer_a) {
+	FM_OPN &opn = this->OPN;
+	std::span<FM_CHANNEL, 6> cch = CH;
+
+	/* the LFO PM step (and with it the phase step of PM channels) only changes when the LFO steps */
+	bool lfo_steps = opn.lfo_timer_overflow
+	                 && opn.lfo_timer + static_cast<uint64_t>(opn.lfo_timer_add) * length >= opn.lfo_timer_overflow;
+
+	/* phase step of every slot, only recalculated when the LFO PM step changes */
+	std::array<std::array<uint32_t, 4>, 6> incr{};
+	uint32_t lfo_pm = opn.LFO_PM;
+
+	std::array<bool, 6> active{};
+	for(size_t c = 0; c < cch.size(); c++) {
+		FM_CHANNEL &channel = cch[c];
+		active[c] = !channel.Muted && !(c == 5 && dacEnable != 0);
+
+		/* with a constant phase step and without SSG-EG (which can reset the phase) the phase is a plain ramp */
+		block.ramp[c] = active[c] && (!channel.pms || !lfo_steps);
+		for(auto &slot: channel.SLOTs) {
+			block.ramp[c] = block.ramp[c] && !(slot.ssg & 0x08);
+		}
+		if(!active[c]) {
+			continue;
+		}
+		incr[c] = phase_step(channel);
+		if(block.ramp[c]) {
+			for(int s = 0; s < 4; s++) {
+				FM_SLOT &slot = channel.SLOTs[s];
+				phase_ramp(block.phase[c][s], slot.phase, incr[c][s]);
+				slot.phase += incr[c][s] * static_cast<uint32_t>(length);
+			}
+		}
+	}
+
+	/* state pass */
+	for(size_t k = 0; k < length; k++) {
 		/* update SSG-EG output */
 		for(auto &channel: cch) {
 			channel.update_ssg_eg_channel();
@@ -1811,20 +2260,36 @@ void YM2612::update(FMSAMPLE **buffer, size_t length) {
 		cch[5].update_ssg_eg_channel();
 		 */
 
-		/* calculate FM */
-		chan_calc(cch[0]);
-		chan_calc(cch[1]);
-		chan_calc(cch[2]);
-		chan_calc(cch[3]);
-		chan_calc(cch[4]);
-		if(dacEnable != 0) {
-			*cch[5].connect4 += dacOut;
-		} else {
-			chan_calc(cch[5]);
+		for(size_t c = 0; c < cch.size(); c++) {
+			if(!active[c]) {
+				continue;
+			}
+
+			FM_CHANNEL &channel = cch[c];
+			uint32_t AM = opn.LFO_AM >> channel.ams;
+			for(int s = 0; s < 4; s++) {
+				block.env[c][s][k] = volume_calc(channel.SLOTs[s], AM);
+			}
+
+			/* update phase counters AFTER output calculations */
+			if(!block.ramp[c]) {
+				for(int s = 0; s < 4; s++) {
+					block.phase[c][s][k] = channel.SLOTs[s].phase;
+					channel.SLOTs[s].phase += incr[c][s];
+				}
+			}
 		}
 
 		/* advance LFO */
 		opn.advance_lfo();
+		if(opn.LFO_PM != lfo_pm) {
+			lfo_pm = opn.LFO_PM;
+			for(size_t c = 0; c < cch.size(); c++) {
+				if(active[c] && !block.ramp[c] && cch[c].pms) {
+					incr[c] = phase_step(cch[c]);
+				}
+			}
+		}
 
 		/* advance envelope generator */
 		opn.eg_timer += opn.eg_timer_add;
@@ -1846,43 +2311,28 @@ void YM2612::update(FMSAMPLE **buffer, size_t length) {
 			 */
 		}
 
-		for(auto &item: out_fm) {
-			item = std::clamp(item, -8192, 8192);
-		}
+		update_csm(timer_a && k == length - 1);
+	}
 
-		/*
-		if(out_fm[0] > 8192) {
-			out_fm[0] = 8192;
-		} else if(out_fm[0] < -8192)
-			out_fm[0] = -8192;
-		if(out_fm[1] > 8192) {
-			out_fm[1] = 8192;
-		} else if(out_fm[1] < -8192)
-			out_fm[1] = -8192;
-		if(out_fm[2] > 8192) {
-			out_fm[2] = 8192;
-		} else if(out_fm[2] < -8192)
-			out_fm[2] = -8192;
-		if(out_fm[3] > 8192) {
-			out_fm[3] = 8192;
-		} else if(out_fm[3] < -8192)
-			out_fm[3] = -8192;
-		if(out_fm[4] > 8192) {
-			out_fm[4] = 8192;
-		} else if(out_fm[4] < -8192)
-			out_fm[4] = -8192;
-		if(out_fm[5] > 8192) {
-			out_fm[5] = 8192;
-		} else if(out_fm[5] < -8192)
-			out_fm[5] = -8192;
-		 */
+	/* calculate FM */
+	for(size_t c = 0; c < cch.size(); c++) {
+		if(active[c]) {
+			chan_calc(cch[c], static_cast<int>(c), length);
+		} else if(c == 5 && dacEnable != 0) {
+			block.out[c].fill(dacOut);
+		} else {
+			block.out[c].fill(0);
+		}
+	}
 
+	/* 6-channels mixing  */
+	for(size_t k = 0; k < length; k++) {
 		FMSAMPLE lt = 0;
 		FMSAMPLE rt = 0;
-		/* 6-channels mixing  */
 		for(auto fm = 0, pan = 0; fm < 6; fm++) {
-			lt += FMSAMPLE((out_fm[fm] >> 0) & opn.pan[pan++]);
-			rt += FMSAMPLE((out_fm[fm] >> 0) & opn.pan[pan++]);
+			int32_t out_fm = std::clamp(block.out[fm][k], -8192, 8192);
+			lt += FMSAMPLE((out_fm >> 0) & opn.pan[pan++]);
+			rt += FMSAMPLE((out_fm >> 0) & opn.pan[pan++]);
 		}
 		/*
 		lt = ((out_fm[0] >> 0) & opn.pan[0]);
@@ -1904,27 +2354,195 @@ void YM2612::update(FMSAMPLE **buffer, size_t length) {
 #endif
 
 		/* buffering */
-		bufL[i] = lt;
-		bufR[i] = rt;
+		bufL[k] = lt;
+		bufR[k] = rt;
+	}
+}
 
-		/* CSM mode: if CSM Key ON has occured, CSM Key OFF need to be sent       */
-		/* only if Timer A does not overflow again (i.e CSM Key ON not set again) */
-		opn.SL3.key_csm <<= 1;
+/* CSM mode: if CSM Key ON has occured, CSM Key OFF need to be sent       */
+/* only if Timer A does not overflow again (i.e CSM Key ON not set again) */
+void YM2612::update_csm(bool timer_a) {
+	FM_OPN &opn = this->OPN;
+	opn.SL3.key_csm <<= 1;
 
-		/* CSM Mode Key ON still disabled */
-		if(opn.SL3.key_csm & 2) {
-			/* CSM Mode Key OFF (verified by Nemesis on real hardware) */
-			for(auto &slot: cch[2].SLOTs) {
-				slot.KEYOFF_CSM();
+	/* CSM Mode Key ON on Timer A overflow */
+	if(timer_a && (opn.STATE.mode & 0xC0) == 0x80) {
+		for(auto &slot: CH[2].SLOTs) {
+			slot.KEYON_CSM(opn.SL3.key_csm);
+		}
+		opn.SL3.key_csm = 1;
+	}
+
+	/* CSM Mode Key ON still disabled */
+	if(opn.SL3.key_csm & 2) {
+		/* CSM Mode Key OFF (verified by Nemesis on real hardware) */
+		for(auto &slot: CH[2].SLOTs) {
+			slot.KEYOFF_CSM();
+		}
+		/*
+		cch[2].SLOTs[SLOT1].KEYOFF_CSM();
+		cch[2].SLOTs[SLOT2].KEYOFF_CSM();
+		cch[2].SLOTs[SLOT3].KEYOFF_CSM();
+		cch[2].SLOTs[SLOT4].KEYOFF_CSM();
+		 */
+		opn.SL3.key_csm = 0;
+	}
+}
+
+/* Advance one of the YM2612s without generating output.                          */
+/* The chip ends up in exactly the state update() leaves it in, but operators are */
+/* only calculated where their output feeds back into the chip (SLOT1 feedback).  */
+void YM2612::advance(size_t length) {
+	/* op1_out and mem_value are one sample delayed each, they are rebuilt by rendering the last samples */
+	constexpr size_t RENDER_TAIL = 2;
+	std::array<FMSAMPLE, RENDER_TAIL * 2> tail{};
+	std::array<FMSAMPLE *, 2> tailBuf = {&tail[0], &tail[RENDER_TAIL]};
+
+	if(length <= RENDER_TAIL) {
+		update(tailBuf.data(), length);
+		return;
+	}
+
+	refresh_fc_eg();
+	advance_counters(length - RENDER_TAIL);
+	update(tailBuf.data(), RENDER_TAIL);
+}
+
+/* true if every operator is quiet and stays so until the next register write: all envelopes */
+/* are off, no SLOT1 output or MEM value is left over, and neither CSM nor the DAC makes sound */
+bool YM2612::silent() const {
+	const FM_OPN &opn = this->OPN;
+	if(opn.SL3.key_csm || ((opn.STATE.mode & 0xC0) == 0x80 && opn.STATE.TAC > 0)) {
+		return false;
+	}
+	if(dacEnable != 0 && dacOut != 0 && !MuteDAC) {
+		return false;
+	}
+	for(const auto &channel: CH) {
+		/* MEM is only replaced by rendering where it feeds an operator */
+		bool mem_used = algo_connect[channel.ALGO].mem_connect != NODE_MEM;
+		if(channel.op1_out[0] || channel.op1_out[1] || (mem_used && channel.mem_value)) {
+			return false;
+		}
+		for(const auto &slot: channel.SLOTs) {
+			if(slot.state != EG::Off || slot.vol_out < ENV_QUIET) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* the state part of advance(): timers, phases, envelopes and LFO, split where one of them needs it */
+void YM2612::advance_counters(size_t length) {
+	FM_OPN &opn = this->OPN;
+
+	/* SSG-EG and CSM can change operator state on any sample */
+	bool ssg = false;
+	for(auto &channel: CH) {
+		for(auto &slot: channel.SLOTs) {
+			ssg |= static_cast<bool>(slot.ssg & 0x08);
+		}
+	}
+
+	size_t remaining = length;
+	while(remaining) {
+		size_t until_timer = timer_horizon();
+		if(ssg || opn.SL3.key_csm || until_timer == 1) {
+			for(auto &channel: CH) {
+				channel.update_ssg_eg_channel();
+			}
+			bool timer_a = advance_timers(1);
+			advance_run(1);
+			update_csm(timer_a);
+			remaining--;
+			continue;
+		}
+
+		/* LFO output stays the same until its next step, the run ends before the next timer overflow */
+		size_t run = std::min(remaining, until_timer - 1);
+		if(opn.lfo_timer_overflow && opn.lfo_timer_add) {
+			if(opn.lfo_timer >= opn.lfo_timer_overflow) {
+				run = 1;
+			} else {
+				run = std::min<size_t>(run, (opn.lfo_timer_overflow - opn.lfo_timer + opn.lfo_timer_add - 1) / opn.lfo_timer_add);
 			}
-			/*
-			cch[2].SLOTs[SLOT1].KEYOFF_CSM();
-			cch[2].SLOTs[SLOT2].KEYOFF_CSM();
-			cch[2].SLOTs[SLOT3].KEYOFF_CSM();
-			cch[2].SLOTs[SLOT4].KEYOFF_CSM();
-			 */
-			opn.SL3.key_csm = 0;
 		}
+		advance_timers(run);
+		advance_run(run);
+		remaining -= run;
+	}
+}
+
+/* advance all counters by length samples, the LFO may only step on the last one */
+void YM2612::advance_run(size_t length) {
+	FM_OPN &opn = this->OPN;
+	std::array<FM_CHANNEL *, 6> feedback{};
+	size_t feedbackCount = 0;
+
+	for(size_t c = 0; c < CH.size(); c++) {
+		FM_CHANNEL &channel = CH[c];
+		if(channel.Muted || (c == 5 && dacEnable != 0)) {
+			continue;    /* chan_calc isn't called, phases stand still */
+		}
+		if(channel.FB) {
+			feedback[feedbackCount++] = &channel;
+			continue;
+		}
+
+		/* the phase step only changes with the LFO PM step, so it's the same on every sample */
+		std::array<uint32_t, 4> step = phase_step(channel);
+		for(int i = 0; i < 4; i++) {
+			channel.SLOTs[i].phase += step[i] * static_cast<uint32_t>(length);
+		}
+	}
+
+	if(feedbackCount == 0) {
+		/* nothing depends on the envelope, so EG ticks can be run back to back */
+		uint64_t eg_timer = opn.eg_timer + static_cast<uint64_t>(opn.eg_timer_add) * length;
+		while(eg_timer >= opn.eg_timer_overflow) {
+			eg_timer -= opn.eg_timer_overflow;
+			opn.eg_cnt++;
+
+			for(auto &channel: CH) {
+				opn.advance_eg_channel(channel.SLOTs);
+			}
+		}
+		opn.eg_timer = static_cast<uint32_t>(eg_timer);
+	} else {
+		for(size_t i = 0; i < length; i++) {
+			/* SLOT1 feedback: the only operator output that is part of the chip state */
+			for(size_t c = 0; c < feedbackCount; c++) {
+				FM_CHANNEL &channel = *feedback[c];
+				uint32_t AM = opn.LFO_AM >> channel.ams;
+				unsigned int eg_out = volume_calc(channel.SLOTs[SLOT1], AM);
+				int32_t out = channel.op1_out[0] + channel.op1_out[1];
+				channel.op1_out[0] = channel.op1_out[1];
+
+				channel.op1_out[1] = 0;
+				if(eg_out < ENV_QUIET) {
+					channel.op1_out[1] = op_calc1(channel.SLOTs[SLOT1].phase, eg_out, (out << channel.FB));
+				}
+
+				advance_phase(channel);
+			}
+
+			opn.eg_timer += opn.eg_timer_add;
+			while(opn.eg_timer >= opn.eg_timer_overflow) {
+				opn.eg_timer -= opn.eg_timer_overflow;
+				opn.eg_cnt++;
+
+				for(auto &channel: CH) {
+					opn.advance_eg_channel(channel.SLOTs);
+				}
+			}
+		}
+	}
+
+	/* advance LFO */
+	if(opn.lfo_timer_overflow) {
+		opn.lfo_timer += opn.lfo_timer_add * static_cast<uint32_t>(length - 1);
+		opn.advance_lfo();
 	}
 }
 
@@ -2052,9 +2670,262 @@ int YM2612::write(uint8_t address, uint8_t v) {
 	return OPN.STATE.irq;
 }
 
+/* YM2612 read: all addresses return the status, the busy flag isn't emulated */
+uint8_t YM2612::read([[maybe_unused]] uint8_t address) const {
+	return OPN.STATE.status;
+}
+
 void YM2612::set_mutemask(uint32_t MuteMask) {
 	for(uint8_t CurChn = 0; CurChn < 6; CurChn++) {
 		CH[CurChn].Muted = (MuteMask >> CurChn) & 0x01;
 	}
 	MuteDAC = static_cast<bool>((MuteMask >> 6) & 0x01);
 }
+
+/* take a snapshot of the chip */
+/* State isn't cleared here, so callers that hash or compare snapshots should zero it first (padding) */
+void YM2612::save_state(YM2612_STATE &state) const {
+	const FM_STATE &ST = OPN.STATE;
+
+	state.clock = ST.clock;
+	state.rate = ST.rate;
+	state.REGS = REGS;
+
+	for(size_t c = 0; c < CH.size(); c++) {
+		const FM_CHANNEL &channel = CH[c];
+		FM_CHANNEL_STATE &cs = state.CH[c];
+
+		for(size_t s = 0; s < channel.SLOTs.size(); s++) {
+			const FM_SLOT &SLOT = channel.SLOTs[s];
+			FM_SLOT_STATE &ss = cs.SLOTs[s];
+
+			ss.ar = SLOT.ar;
+			ss.d1r = SLOT.d1r;
+			ss.d2r = SLOT.d2r;
+			ss.rr = SLOT.rr;
+			ss.mul = SLOT.mul;
+			ss.phase = SLOT.phase;
+			ss.Incr = SLOT.Incr;
+			ss.tl = SLOT.tl;
+			ss.volume = SLOT.volume;
+			ss.sl = SLOT.sl;
+			ss.vol_out = SLOT.vol_out;
+			ss.AMmask = SLOT.AMmask;
+			/* DT always points at the start of one of the 8 dt_tab rows */
+			ss.DT = SLOT.DT ? static_cast<uint8_t>((SLOT.DT - OPN.tables->dt_tab[0]) / 32) : 0;
+			ss.KSR = SLOT.KSR;
+			ss.ksr = SLOT.ksr;
+			ss.state = SLOT.state;
+			ss.ssg = SLOT.ssg;
+			ss.ssgn = SLOT.ssgn;
+			ss.key = SLOT.key;
+			ss.eg_sh_ar = SLOT.eg_sh_ar;
+			ss.eg_sel_ar = SLOT.eg_sel_ar;
+			ss.eg_sh_d1r = SLOT.eg_sh_d1r;
+			ss.eg_sel_d1r = SLOT.eg_sel_d1r;
+			ss.eg_sh_d2r = SLOT.eg_sh_d2r;
+			ss.eg_sel_d2r = SLOT.eg_sel_d2r;
+			ss.eg_sh_rr = SLOT.eg_sh_rr;
+			ss.eg_sel_rr = SLOT.eg_sel_rr;
+		}
+
+		cs.op1_out = channel.op1_out;
+		cs.mem_value = channel.mem_value;
+		cs.pms = channel.pms;
+		cs.fc = channel.fc;
+		cs.block_fnum = channel.block_fnum;
+		cs.ALGO = channel.ALGO;
+		cs.FB = channel.FB;
+		cs.ams = channel.ams;
+		cs.kcode = channel.kcode;
+	}
+
+	state.mode = ST.mode;
+	state.TA = ST.TA;
+	state.TAC = ST.TAC;
+	state.TBC = ST.TBC;
+	state.TB = ST.TB;
+	state.address = ST.address;
+	state.status = ST.status;
+	state.fn_h = ST.fn_h;
+	state.prescaler_sel = ST.prescaler_sel;
+	state.irq = ST.irq;
+	state.irqmask = ST.irqmask;
+	state.addr_A1 = addr_A1;
+
+	state.SL3_fc = OPN.SL3.fc;
+	state.SL3_block_fnum = OPN.SL3.block_fnum;
+	state.SL3_kcode = OPN.SL3.kcode;
+	state.SL3_fn_h = OPN.SL3.fn_h;
+	state.SL3_key_csm = OPN.SL3.key_csm;
+
+	state.lfo_cnt = OPN.lfo_cnt;
+	state.pan = OPN.pan;
+	state.eg_cnt = OPN.eg_cnt;
+	state.eg_timer = OPN.eg_timer;
+	state.lfo_timer = OPN.lfo_timer;
+	state.lfo_timer_overflow = OPN.lfo_timer_overflow;
+	state.LFO_AM = OPN.LFO_AM;
+	state.LFO_PM = OPN.LFO_PM;
+
+	state.dacEnable = dacEnable;
+	state.dacOut = dacOut;
+}
+
+/* a snapshot may come from a file, so everything that indexes a table or selects a shift has to be in the */
+/* range the chip itself produces, else it would read out of bounds later on */
+static bool state_in_range(const YM2612_STATE &state, const FM_OPN &OPN) {
+	constexpr uint32_t max_rate = 32 + 62;            /* ar/d1r/d2r/rr, ksr is added to index the rate tables */
+	constexpr uint32_t max_tl = 0x7f << (ENV_BITS - 7);
+	constexpr uint32_t max_block_fnum = 0x3fff;       /* block << 11 | fnum */
+	constexpr uint8_t max_sh = *std::ranges::max_element(eg_rate_shift);
+	constexpr int32_t max_out = 1 << 13;              /* operator outputs are 14 bits with the sign */
+	const uint32_t max_fc = OPN.tables->fn_table.back();
+	auto eg_sel_ok = [](uint8_t sel) { return sel % RATE_STEPS == 0 && sel <= 18 * RATE_STEPS; };
+	auto out_ok = [](int32_t out) { return out >= -max_out && out <= max_out; };
+
+	for(const FM_CHANNEL_STATE &cs : state.CH) {
+		for(const FM_SLOT_STATE &ss : cs.SLOTs) {
+			if(ss.ar > max_rate || ss.d1r > max_rate || ss.d2r > max_rate || ss.rr > max_rate || ss.ksr >= 32
+			   || ss.mul > 30 || ss.tl > max_tl || ss.DT >= 8 || ss.KSR > 3 || ss.state > EG::Attack) {
+				return false;
+			}
+			if(ss.volume < MIN_ATT_INDEX || ss.volume > MAX_ATT_INDEX || ss.vol_out > MAX_ATT_INDEX + max_tl
+			   || std::ranges::find(sl_table, ss.sl) == sl_table.end() || (ss.AMmask != 0 && ss.AMmask != ~0u)) {
+				return false;
+			}
+			if(ss.ssg > 0x0f || (ss.ssgn != 0 && ss.ssgn != 4) || ss.key > 1) {
+				return false;
+			}
+			if(ss.eg_sh_ar > max_sh || ss.eg_sh_d1r > max_sh || ss.eg_sh_d2r > max_sh || ss.eg_sh_rr > max_sh
+			   || !eg_sel_ok(ss.eg_sel_ar) || !eg_sel_ok(ss.eg_sel_d1r) || !eg_sel_ok(ss.eg_sel_d2r) || !eg_sel_ok(ss.eg_sel_rr)) {
+				return false;
+			}
+		}
+		if(!out_ok(cs.op1_out[0]) || !out_ok(cs.op1_out[1]) || !out_ok(cs.mem_value) || cs.fc > max_fc) {
+			return false;
+		}
+		if(cs.ALGO >= 8 || (cs.FB != 0 && (cs.FB < 7 || cs.FB > 13)) || cs.kcode >= 32 || cs.block_fnum > max_block_fnum
+		   || cs.pms < 0 || cs.pms > 7 * 32 || cs.pms % 32 != 0 || std::ranges::find(lfo_ams_depth_shift, cs.ams) == lfo_ams_depth_shift.end()) {
+			return false;
+		}
+	}
+
+	if(state.TA < 0 || state.TA > 1023 || state.addr_A1 > 1 || state.SL3_key_csm > 1) {
+		return false;
+	}
+	for(size_t c = 0; c < state.SL3_kcode.size(); c++) {
+		if(state.SL3_kcode[c] >= 32 || state.SL3_block_fnum[c] > max_block_fnum || state.SL3_fc[c] > max_fc) {
+			return false;
+		}
+	}
+	if(state.lfo_cnt >= 128 || state.LFO_AM > 126 || state.LFO_PM >= 32 || state.eg_timer >= OPN.eg_timer_overflow) {
+		return false;
+	}
+	if(state.lfo_timer_overflow != 0
+	   && std::ranges::find(lfo_samples_per_step, state.lfo_timer_overflow >> LFO_SH) == lfo_samples_per_step.end()) {
+		return false;
+	}
+	if(std::ranges::any_of(state.pan, [](uint32_t mask) { return mask != 0 && mask != ~0u; })) {
+		return false;
+	}
+	return (state.dacEnable == 0 || state.dacEnable == 0x80) && state.dacOut % 64 == 0
+	       && state.dacOut >= -0x80 * 64 && state.dacOut <= 0x7f * 64;
+}
+
+/* restore a snapshot taken with save_state */
+/* the chip must run at the same clock and rate, as the time tables aren't part of the snapshot */
+/* returns false without touching the chip if it doesn't or the snapshot is out of range */
+bool YM2612::load_state(const YM2612_STATE &state) {
+	FM_STATE &ST = OPN.STATE;
+
+	if(state.clock != ST.clock || state.rate != ST.rate || !state_in_range(state, OPN)) {
+		return false;
+	}
+
+	REGS = state.REGS;
+
+	for(size_t c = 0; c < CH.size(); c++) {
+		FM_CHANNEL &channel = CH[c];
+		const FM_CHANNEL_STATE &cs = state.CH[c];
+
+		for(size_t s = 0; s < channel.SLOTs.size(); s++) {
+			FM_SLOT &SLOT = channel.SLOTs[s];
+			const FM_SLOT_STATE &ss = cs.SLOTs[s];
+
+			SLOT.ar = ss.ar;
+			SLOT.d1r = ss.d1r;
+			SLOT.d2r = ss.d2r;
+			SLOT.rr = ss.rr;
+			SLOT.mul = ss.mul;
+			SLOT.phase = ss.phase;
+			SLOT.Incr = ss.Incr;
+			SLOT.tl = ss.tl;
+			SLOT.volume = ss.volume;
+			SLOT.sl = ss.sl;
+			SLOT.vol_out = ss.vol_out;
+			SLOT.AMmask = ss.AMmask;
+			SLOT.DT = OPN.tables->dt_tab[ss.DT];
+			SLOT.KSR = ss.KSR;
+			SLOT.ksr = ss.ksr;
+			SLOT.state = ss.state;
+			SLOT.ssg = ss.ssg;
+			SLOT.ssgn = ss.ssgn;
+			SLOT.key = ss.key;
+			SLOT.eg_sh_ar = ss.eg_sh_ar;
+			SLOT.eg_sel_ar = ss.eg_sel_ar;
+			SLOT.eg_sh_d1r = ss.eg_sh_d1r;
+			SLOT.eg_sel_d1r = ss.eg_sel_d1r;
+			SLOT.eg_sh_d2r = ss.eg_sh_d2r;
+			SLOT.eg_sel_d2r = ss.eg_sel_d2r;
+			SLOT.eg_sh_rr = ss.eg_sh_rr;
+			SLOT.eg_sel_rr = ss.eg_sel_rr;
+		}
+
+		channel.op1_out = cs.op1_out;
+		channel.mem_value = cs.mem_value;
+		channel.pms = cs.pms;
+		channel.fc = cs.fc;
+		channel.block_fnum = cs.block_fnum;
+		channel.ALGO = cs.ALGO;
+		channel.FB = cs.FB;
+		channel.ams = cs.ams;
+		channel.kcode = cs.kcode;
+
+		/* rebuild the connection pointers */
+		OPN.setup_connection(channel, static_cast<int>(c));
+	}
+
+	ST.mode = state.mode;
+	ST.TA = state.TA;
+	ST.TB = state.TB;
+	/* the counters count down samples from their reload value, anything above it would delay the overflow */
+	ST.TAC = std::clamp(state.TAC, 0, 1024 - ST.TA);
+	ST.TBC = std::clamp(state.TBC, 0, (256 - ST.TB) << 4);
+	ST.address = state.address;
+	ST.status = state.status;
+	ST.fn_h = state.fn_h;
+	ST.prescaler_sel = state.prescaler_sel;
+	ST.irq = state.irq;
+	ST.irqmask = state.irqmask;
+	addr_A1 = state.addr_A1;
+
+	OPN.SL3.fc = state.SL3_fc;
+	OPN.SL3.block_fnum = state.SL3_block_fnum;
+	OPN.SL3.kcode = state.SL3_kcode;
+	OPN.SL3.fn_h = state.SL3_fn_h;
+	OPN.SL3.key_csm = state.SL3_key_csm;
+
+	OPN.lfo_cnt = state.lfo_cnt;
+	OPN.pan = state.pan;
+	OPN.eg_cnt = state.eg_cnt;
+	OPN.eg_timer = state.eg_timer;
+	OPN.lfo_timer = state.lfo_timer;
+	OPN.lfo_timer_overflow = state.lfo_timer_overflow;
+	OPN.LFO_AM = state.LFO_AM;
+	OPN.LFO_PM = state.LFO_PM;
+
+	dacEnable = state.dacEnable;
+	dacOut = state.dacOut;
+	return true;
+}
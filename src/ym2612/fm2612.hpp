@@ -4,17 +4,39 @@
 
 #include <cstdint>
 #include <array>
+#include <memory>
 #include <span>
 
 
 void ym2612_stream_update(uint8_t ChipID, stream_sample_t **outputs, size_t samples);
-int device_start_ym2612(uint8_t ChipID, int clock);
+void ym2612_stream_skip(uint8_t ChipID, size_t samples);    /* like ym2612_stream_update, without output */
+/* memory: optional storage for the chip, sizeof(YM2612) bytes aligned to alignof(YM2612), owned by the caller */
+int device_start_ym2612(uint8_t ChipID, int clock, void *memory = nullptr);
 void device_stop_ym2612(uint8_t ChipID);
 void device_reset_ym2612(uint8_t ChipID);
 
 void ym2612_w(uint8_t ChipID, offs_t offset, uint8_t data);
+uint8_t ym2612_r(uint8_t ChipID, offs_t offset);    /* status: bit 0 Timer A, bit 1 Timer B overflowed */
+bool ym2612_timer_running(uint8_t ChipID);
+bool ym2612_silent(uint8_t ChipID);    /* nothing but silence until the next register write */
+uint32_t ym2612_timer_b_ticks(uint8_t ChipID);    /* Timer B overflows since the chip was started */
 void ym2612_set_mute_mask(uint8_t ChipID, uint32_t MuteMask);
 
+/* SIMD code paths of the block renderer, all produce the same output */
+enum class FM_ISA : uint8_t {
+	SCALAR = 1,
+	SSE41 = 2,
+	AVX2 = 3,
+	AVX512 = 4,
+};
+FM_ISA ym2612_supported_isa(FM_ISA max);    /* widest one up to max the CPU supports */
+FM_ISA ym2612_select_isa(FM_ISA isa);        /* for all chips, falls back to ym2612_supported_isa(isa), default is SCALAR */
+FM_ISA ym2612_get_isa();
+
+struct YM2612_STATE;
+void ym2612_save_state(uint8_t ChipID, YM2612_STATE &State);
+bool ym2612_load_state(uint8_t ChipID, const YM2612_STATE &State);
+
 
 void ym2612_update_request(void *param);
 
@@ -27,6 +49,7 @@ using FM_IRQHANDLER = void (*)(void *, int);
 // declare our structs early, so we can use them in definitions
 struct FM_SLOT;
 struct FM_CHANNEL;
+struct FM_RATE_TABLES;
 struct FM_STATE;
 struct FM_3SLOT;
 struct FM_OPN;
@@ -44,7 +67,7 @@ struct YM2612;
 
 /* struct describing a single operator (SLOT) */
 struct FM_SLOT{
-	int32_t *DT;        /* detune          :dt_tab[DT] */
+	const int32_t *DT;  /* detune          :dt_tab[DT] */
 	uint8_t KSR;        /* key scale rate  :3-KSR */
 	uint32_t ar;            /* attack rate  */
 	uint32_t d1r;        /* decay rate   */
@@ -84,9 +107,10 @@ struct FM_SLOT{
 	void KEYON(uint8_t CsmOn = 0);
 	void KEYOFF(uint8_t CsmOn = 0);
 
+	void KEYON_CSM(uint8_t CsmOn);
 	void KEYOFF_CSM();
 
-	void set_det_mul(FM_STATE &ST, FM_CHANNEL &CH, int v);  /* set detune & multiple */
+	void set_det_mul(const FM_RATE_TABLES &tables, FM_CHANNEL &CH, int v);  /* set detune & multiple */
 	void set_tl(int v);                                     /* set total level */
 	void set_ar_ksr(FM_CHANNEL &CH, int v);                 /* set attack rate & key scale  */
 	void set_dr(int v);                                     /* set decay rate */
@@ -120,6 +144,15 @@ struct FM_CHANNEL {
 	void update_ssg_eg_channel();
 };
 
+/* time tables, they only depend on the clock, rate and prescaler and are shared read-only between chips */
+struct FM_RATE_TABLES{
+	int32_t dt_tab[8][32];        /* DeTune table         */
+	/* there are 2048 FNUMs that can be generated using FNUM/BLK registers
+       but LFO works with one more bit of a precision so we really need 4096 elements */
+	std::array<uint32_t, 4096> fn_table; /* fnumber->increment counter */
+	uint32_t fn_max;    /* maximal phase increment (used for phase overflow) */
+};
+
 struct FM_STATE {
 	//running_device *device;
 	void *param;                /* this chip parameter  */
@@ -141,8 +174,6 @@ struct FM_STATE {
 	int32_t TAC = 0;                /* timer a counter      */
 	uint8_t TB;                    /* timer b              */
 	int32_t TBC = 0;                /* timer b counter      */
-	/* local time tables */
-	int32_t dt_tab[8][32];        /* DeTune table         */
 	/* Extention Timer and IRQ handler */
 };
 
@@ -173,10 +204,7 @@ struct FM_OPN{
 	uint32_t eg_timer_overflow;/* envelope generator timer overlfows every 3 samples (on real chip) */
 
 
-	/* there are 2048 FNUMs that can be generated using FNUM/BLK registers
-       but LFO works with one more bit of a precision so we really need 4096 elements */
-	std::array<uint32_t, 4096> fn_table; /* fnumber->increment counter */
-	uint32_t fn_max;    /* maximal phase increment (used for phase overflow) */
+	std::shared_ptr<const FM_RATE_TABLES> tables;    /* shared with all chips at the same clock/rate/prescaler */
 
 	/* LFO */
 	uint8_t lfo_cnt = 0;            /* current LFO phase (out of 128) */
@@ -197,7 +225,6 @@ struct FM_OPN{
 	void SetPres(int pres, int timer_prescaler);
 	void set_timers(FM_STATE &ST, int v);
 
-	void init_timetables(const double &freqbase);
 	void advance_eg_channel(std::span<FM_SLOT, 4> SLOTS);
 	void advance_lfo(); /* advance LFO to next sample */
 	void update_phase_lfo_slot(FM_SLOT &SLOT, int32_t pms, uint32_t block_fnum);
@@ -206,6 +233,110 @@ struct FM_OPN{
 	void refresh_fc_eg_chan(FM_CHANNEL &CH);
 };
 
+/***********************************************************/
+/* Snapshot                                                */
+/***********************************************************/
+
+/* Plain copies of everything that evolves while the chip runs. Pointers (DT, connections) are */
+/* stored as indices and rebuilt on load, tables derived from clock/rate are not stored at all. */
+
+/* snapshot of one operator */
+struct FM_SLOT_STATE{
+	uint32_t ar;            /* attack rate  */
+	uint32_t d1r;           /* decay rate   */
+	uint32_t d2r;           /* sustain rate */
+	uint32_t rr;            /* release rate */
+	uint32_t mul;           /* multiple     */
+	uint32_t phase;         /* phase counter */
+	int32_t Incr;           /* phase step */
+	uint32_t tl;            /* total level */
+	int32_t volume;         /* envelope counter */
+	uint32_t sl;            /* sustain level */
+	uint32_t vol_out;       /* EG output */
+	uint32_t AMmask;        /* AM enable flag */
+	uint8_t DT;             /* detune index into dt_tab */
+	uint8_t KSR;
+	uint8_t ksr;
+	uint8_t state;
+	uint8_t ssg;
+	uint8_t ssgn;
+	uint8_t key;
+	uint8_t eg_sh_ar, eg_sel_ar;
+	uint8_t eg_sh_d1r, eg_sel_d1r;
+	uint8_t eg_sh_d2r, eg_sel_d2r;
+	uint8_t eg_sh_rr, eg_sel_rr;
+};
+
+/* snapshot of one channel (connections are rebuilt from ALGO) */
+struct FM_CHANNEL_STATE{
+	std::array<FM_SLOT_STATE, 4> SLOTs;
+	std::array<int32_t, 2> op1_out;
+	int32_t mem_value;
+	int32_t pms;
+	uint32_t fc;
+	uint32_t block_fnum;
+	uint8_t ALGO;
+	uint8_t FB;
+	uint8_t ams;
+	uint8_t kcode;
+};
+
+/* snapshot of a whole chip */
+struct YM2612_STATE{
+	uint32_t clock;         /* must match the chip it is loaded into */
+	uint32_t rate;
+
+	std::array<uint8_t, 512> REGS;
+	std::array<FM_CHANNEL_STATE, 6> CH;
+
+	/* FM_STATE */
+	uint32_t mode;
+	int32_t TA;
+	int32_t TAC;
+	int32_t TBC;
+	uint8_t TB;
+	uint8_t address;
+	uint8_t status;
+	uint8_t fn_h;
+	uint8_t prescaler_sel;
+	uint8_t irq;
+	uint8_t irqmask;
+	uint8_t addr_A1;
+
+	/* FM_3SLOT */
+	std::array<uint32_t, 3> SL3_fc;
+	std::array<uint32_t, 3> SL3_block_fnum;
+	std::array<uint8_t, 3> SL3_kcode;
+	uint8_t SL3_fn_h;
+	uint8_t SL3_key_csm;
+
+	/* FM_OPN */
+	uint8_t lfo_cnt;
+	uint8_t reserved;
+	std::array<uint32_t, 6 * 2> pan;
+	uint32_t eg_cnt;
+	uint32_t eg_timer;
+	uint32_t lfo_timer;
+	uint32_t lfo_timer_overflow;
+	uint32_t LFO_AM;
+	uint32_t LFO_PM;
+
+	/* DAC */
+	int32_t dacEnable;
+	int32_t dacOut;
+};
+
+/* samples rendered at once by YM2612::update */
+constexpr size_t FM_BLOCK = 16;
+
+/* per-block scratch of the renderer, indexed [channel][slot][sample] */
+struct FM_BLOCK_BUFFER{
+	alignas(64) std::array<std::array<std::array<uint32_t, FM_BLOCK>, 4>, 6> phase;    /* phase counter */
+	alignas(64) std::array<std::array<std::array<uint32_t, FM_BLOCK>, 4>, 6> env;      /* EG output incl. AM */
+	alignas(64) std::array<std::array<int32_t, FM_BLOCK>, 6> out;                      /* channel output */
+	std::array<bool, 6> ramp;    /* phase is phase0 + k * Incr */
+};
+
 /* here's the virtual YM2612 */
 struct YM2612{
 	std::array<uint8_t, 512> REGS;            /* registers            */
@@ -218,6 +349,10 @@ struct YM2612{
 	int32_t dacOut = 0;
 	bool MuteDAC = false;
 
+	uint32_t timer_b_ticks = 0;    /* Timer B overflows, whether or not they set the status flag */
+
+	FM_BLOCK_BUFFER block{};
+
 	YM2612(void *param, int baseclock, int rate);
 
 	~YM2612();
@@ -226,10 +361,26 @@ struct YM2612{
 	void reset_channels(int num);
 
 	void update(FMSAMPLE **buffer, size_t length);
+	void advance(size_t length);    /* update() without output */
+	bool silent() const;    /* nothing but silence until the next register write */
 
 	int write(uint8_t address, uint8_t v);
+	uint8_t read(uint8_t address) const;
 
 	void set_mutemask(uint32_t MuteMask);
 
-	void chan_calc(FM_CHANNEL &channel);
+	void save_state(YM2612_STATE &state) const;
+	bool load_state(const YM2612_STATE &state);
+
+	void render_block(FMSAMPLE *bufL, FMSAMPLE *bufR, size_t length, int32_t dacOut, bool timer_a);
+	void chan_calc(FM_CHANNEL &channel, int ch, size_t length);
+	void advance_phase(FM_CHANNEL &channel);
+	std::array<uint32_t, 4> phase_step(FM_CHANNEL &channel);    /* phase increments at the current LFO PM step */
+	void advance_counters(size_t length);
+	void advance_run(size_t length);
+	void refresh_fc_eg();
+	void update_csm(bool timer_a = false);
+
+	size_t timer_horizon() const;
+	bool advance_timers(size_t length);
 };
\ No newline at end of file